@@ -0,0 +1,305 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "core.h"
+#include "lat.h"
+#include "log.h"
+#include "mio.h"
+#include "mmi.h"
+#include "seq.h"
+
+/** default duration of a benchmark in seconds */
+#define DEFAULT_DURATION 10
+
+/** default tempo of the sequencer benchmark in bpm */
+#define DEFAULT_TEMPO 130
+
+/** default number of events of the midi io benchmark */
+#define DEFAULT_EVENTS 1000
+
+/** interval between events of the midi io benchmark in ms */
+#define EVENT_INTERVAL 5
+
+/** time an event may take to come back before it counts as lost in ms */
+#define EVENT_TIMEOUT 100
+
+static void usage(const char *name);
+static int bench_seq(int argc, char *argv[]);
+static void fill_pattern(pattern_t *pattern);
+static int bench_mio(int argc, char *argv[]);
+static long receive_event(mio_stream_t *input, int index, long long sent);
+static void print_stats(const char *name, long *values, int count);
+static int compare_long(const void *a, const void *b);
+
+int main(int argc, char *argv[])
+{
+	int result = -1;
+	
+	if (argc < 2) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	
+	if (strcmp(argv[1], "seq") == 0)
+		result = bench_seq(argc - 2, argv + 2);
+	else if (strcmp(argv[1], "mio") == 0)
+		result = bench_mio(argc - 2, argv + 2);
+	else
+		usage(argv[0]);
+	
+	exit(result == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/**
+ * Prints the usage.
+ * @param name Program name
+ */
+static void usage(const char *name)
+{
+	printf("usage: %s seq [seconds] [bpm]\n", name);
+	printf("       %s mio <backend> <output> <input> [events] [latency]\n", name);
+	printf("  seq  plays a pattern with all lines busy on the null backend and reports\n");
+	printf("       pulses per second and the sequencer cpu time per pulse\n");
+	printf("  mio  writes timestamped events to an output connected back to an input\n");
+	printf("       (e.g. snd-seq-dummy or a loopback cable) and reports the latency and\n");
+	printf("       jitter they are read back with\n");
+}
+
+/**
+ * Runs the core on the null backend with all lines playing notes, and
+ * reports the pulse rate and the cpu time the sequencer thread needs for a
+ * pulse. The screen is rendered offscreen, so that the numbers include the
+ * contention a running ssq sees.
+ * @param argc Number of arguments
+ * @param argv Arguments: duration in seconds, tempo in bpm
+ * @return Returns 0 if successful.
+ */
+static int bench_seq(int argc, char *argv[])
+{
+	config_t config;
+	seq_snapshot_t snapshot;
+	lat_stats_t cpu, lateness;
+	long long start, end;
+	int duration = argc > 0 ? atoi(argv[0]) : DEFAULT_DURATION;
+	float tempo = argc > 1 ? atof(argv[1]) : DEFAULT_TEMPO;
+	double elapsed;
+	
+	if (duration <= 0 || tempo <= 0) {
+		LOG(LOG_ERROR, "invalid duration or tempo");
+		return -1;
+	}
+	
+	/* output goes nowhere, the devices only have to be present */
+	config_default(&config);
+	strncpy(config.midi_backend, "null", sizeof(config.midi_backend));
+	strncpy(config.renderer, "software", sizeof(config.renderer));
+	config.headless = 1;
+	config.rescan_interval = 0;
+	strncpy(config.seq_output, "Loopback 1", sizeof(config.seq_output));
+	strncpy(config.seq_input, "Loopback 2", sizeof(config.seq_input));
+	strncpy(config.surfaces[0].input, "Loopback 3", sizeof(config.surfaces[0].input));
+	strncpy(config.surfaces[0].output, "Loopback 3", sizeof(config.surfaces[0].output));
+	
+	if (core_init_config(&config) != 0)
+		return -1;
+	
+	fill_pattern(seq_get_pattern());
+	seq_set_tempo(tempo);
+	seq_start();
+	
+	/* the main thread does what core_run() does */
+	start = lat_now();
+	end = start + duration * 1000000LL;
+	while (lat_now() < end)
+		mmi_update();
+	
+	seq_get_snapshot(&snapshot);
+	elapsed = (lat_now() - start) / 1000000.0;
+	seq_stop();
+	
+	lat_get_stats(&snapshot.stats.cpu_time_hist, &cpu);
+	lat_get_stats(&snapshot.stats.lateness_hist, &lateness);
+	
+	printf("%d pulses in %.1f s: %.1f pulses/s (%.1f expected at %.1f bpm)\n",
+		snapshot.pulse, elapsed, snapshot.pulse / elapsed, tempo * 24 / 60, tempo);
+	printf("seq cpu us/pulse: p50 %ld p99 %ld max %ld (%u pulses)\n", cpu.p50, cpu.p99, cpu.max, cpu.count);
+	printf("pulse late us: p50 %ld p99 %ld max %ld\n", lateness.p50, lateness.p99, lateness.max);
+	
+	core_shutdown();
+	
+	return 0;
+}
+
+/**
+ * Makes every line of a pattern play a note on every step.
+ * @param pattern Pattern
+ */
+static void fill_pattern(pattern_t *pattern)
+{
+	line_t *line;
+	int i, j, step;
+	
+	for (i = 0; i < NUM_SEQUENCES; i++) {
+		for (j = 0; j < NUM_LINES; j++) {
+			line = &pattern->sequences[i].lines[j];
+			param_set(&line->line_mode, LINE_MODE_NOTE);
+			for (step = 0; step < NUM_STEPS; step++)
+				param_set(&line->step_modes[step], STEP_MODE_ON);
+		}
+	}
+}
+
+/**
+ * Writes events to an output stream which is connected back to an input
+ * stream, and reports the latency and jitter they are read back with. The
+ * latency of an event is measured from the time it is scheduled for (the
+ * time it is written plus the output latency) to the time mio_read()
+ * returns it. The jitter is the deviation from the mean latency.
+ * @param argc Number of arguments
+ * @param argv Arguments: backend, output, input, number of events, output
+ * latency in ms
+ * @return Returns 0 if successful.
+ */
+static int bench_mio(int argc, char *argv[])
+{
+	mio_stream_t output, input;
+	mio_event_t event;
+	long *latencies = NULL, *jitters = NULL;
+	long long sent, sum = 0;
+	long elapsed, mean;
+	int count, latency, i, received = 0;
+	int result = -1;
+	
+	if (argc < 3) {
+		LOG(LOG_ERROR, "backend, output and input are required");
+		return -1;
+	}
+	count = argc > 3 ? atoi(argv[3]) : DEFAULT_EVENTS;
+	latency = argc > 4 ? atoi(argv[4]) : 0;
+	if (count <= 0 || count > 16384 || latency < 0) {
+		LOG(LOG_ERROR, "invalid number of events or latency");
+		return -1;
+	}
+	
+	if (mio_init(argv[0]) != 0)
+		return -1;
+	
+	if (mio_open_output(&output, argv[1], latency) != 0)
+		goto out_shutdown;
+	if (mio_open_input(&input, argv[2]) != 0)
+		goto out_output;
+	if (!output.handle || !input.handle) {
+		LOG(LOG_ERROR, "output and input must be present");
+		goto out_input;
+	}
+	
+	latencies = calloc(count, sizeof(long));
+	jitters = calloc(count, sizeof(long));
+	if (!latencies || !jitters) {
+		LOG(LOG_ERROR, "cannot allocate memory");
+		goto out_input;
+	}
+	
+	/* the event number is sent as pitch wheel value, which every backend passes unchanged */
+	for (i = 0; i < count; i++) {
+		event.message = mio_message(MIO_CMD_PITCH_WHEEL, 0, i & 0x7f, (i >> 7) & 0x7f);
+		event.timestamp = mio_get_timestamp();
+		sent = lat_now();
+		if (mio_write(&output, &event, 1) != 0)
+			goto out_input;
+		
+		elapsed = receive_event(&input, i, sent);
+		if (elapsed >= 0) {
+			latencies[received] = elapsed - latency * 1000L;
+			sum += latencies[received];
+			received++;
+		}
+		usleep(EVENT_INTERVAL * 1000);
+	}
+	
+	if (received == 0) {
+		LOG(LOG_ERROR, "no events were read back, is the output connected to the input?");
+		goto out_input;
+	}
+	
+	mean = sum / received;
+	for (i = 0; i < received; i++)
+		jitters[i] = labs(latencies[i] - mean);
+	
+	printf("%s: %d of %d events read back, output latency %d ms\n", argv[0], received, count, latency);
+	print_stats("latency", latencies, received);
+	print_stats("jitter", jitters, received);
+	result = 0;
+	
+out_input:
+	mio_close(&input);
+out_output:
+	mio_close(&output);
+out_shutdown:
+	mio_shutdown();
+	free(latencies);
+	free(jitters);
+	
+	return result;
+}
+
+/**
+ * Reads events from an input stream until the event with the given number
+ * arrives. Events which came back too late for an earlier number are
+ * skipped.
+ * @param input Input stream
+ * @param index Event number
+ * @param sent Time the event was written, see lat_now()
+ * @return Returns the time since the event was written in us, -1 if it was
+ * lost.
+ */
+static long receive_event(mio_stream_t *input, int index, long long sent)
+{
+	mio_event_t buf[16];
+	long long deadline = sent + EVENT_TIMEOUT * 1000;
+	int i, count;
+	
+	while (lat_now() < deadline) {
+		if (!mio_wait(&input, 1, (deadline - lat_now()) / 1000 + 1))
+			continue;
+		count = mio_read(input, buf, 16);
+		for (i = 0; i < count; i++)
+			if (mio_message_cmd(buf[i].message) == MIO_CMD_PITCH_WHEEL &&
+				(mio_message_data1(buf[i].message) | (mio_message_data2(buf[i].message) << 7)) == index)
+				return lat_now() - sent;
+	}
+	
+	return -1;
+}
+
+/**
+ * Prints the mean, 99th percentile and maximum of a series of values.
+ * @param name Name of the values
+ * @param values Values in us, sorted in place
+ * @param count Number of values
+ */
+static void print_stats(const char *name, long *values, int count)
+{
+	long long sum = 0;
+	int i;
+	
+	qsort(values, count, sizeof(long), compare_long);
+	for (i = 0; i < count; i++)
+		sum += values[i];
+	
+	printf("%s us: mean %lld p99 %ld max %ld\n", name, sum / count, values[(count - 1) * 99 / 100], values[count - 1]);
+}
+
+/**
+ * Compares two longs for qsort().
+ */
+static int compare_long(const void *a, const void *b)
+{
+	long x = *(const long *) a, y = *(const long *) b;
+	
+	return x < y ? -1 : x > y;
+}
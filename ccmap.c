@@ -0,0 +1,283 @@
+
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "defines.h"
+#include "objects.h"
+#include "para.h"
+#include "ccmap.h"
+
+/** action table entry */
+typedef struct {
+	const char *name;
+	int count;
+} action_entry_t;
+
+/** action table, indexed by action */
+static action_entry_t s_actions[] = {
+	{ "none",         0 },
+	{ "step_value",   NUM_STEPS },
+	{ "step_mode",    NUM_STEPS },
+	{ "line",         NUM_LINES },
+	{ "sequence",     NUM_SEQUENCES },
+	{ "line_param",   NUM_LINE_PARAMS },
+	{ "global_param", NUM_GLOBAL_PARAMS },
+	{ "button",       BUTTON_CC_LAST },
+};
+
+/** default mapping entry */
+typedef struct {
+	ccmap_action_t action;
+	int arg;
+	int count;
+	int cc;
+} default_entry_t;
+
+/** default mapping for the BCR2000 preset */
+static default_entry_t s_defaults[] = {
+	{ CCMAP_STEP_VALUE,   0,              NUM_STEPS,         1 },
+	{ CCMAP_STEP_MODE,    0,              NUM_STEPS,         33 },
+	{ CCMAP_LINE,         0,              NUM_LINES,         65 },
+	{ CCMAP_SEQUENCE,     0,              NUM_SEQUENCES,     73 },
+	{ CCMAP_BUTTON,       BUTTON_CC_F1,   4,                 77 },
+	{ CCMAP_LINE_PARAM,   0,              NUM_LINE_PARAMS,   81 },
+	{ CCMAP_GLOBAL_PARAM, 0,              NUM_GLOBAL_PARAMS, 97 },
+	{ CCMAP_BUTTON,       BUTTON_CC_PLAY, 4,                 105 },
+};
+
+static ccmap_action_t find_action(const char *name);
+
+/*
+ * Clears all mappings.
+ */
+void ccmap_clear(ccmap_t *map)
+{
+	memset(map->entries, 0, sizeof(map->entries));
+	memset(map->controls, 0xff, sizeof(map->controls));
+}
+
+/*
+ * Loads the default mapping.
+ */
+void ccmap_default(ccmap_t *map)
+{
+	default_entry_t *entry;
+	int i, j;
+	
+	ccmap_clear(map);
+	
+	for (i = 0; i < sizeof(s_defaults) / sizeof(s_defaults[0]); i++) {
+		entry = &s_defaults[i];
+		for (j = 0; j < entry->count; j++)
+			ccmap_set(map, 0, entry->cc + j, entry->action, entry->arg + j);
+	}
+}
+
+/*
+ * Returns the entry for a controller.
+ */
+ccmap_entry_t *ccmap_get(ccmap_t *map, int channel, int cc)
+{
+	return &map->entries[channel & 0x0f][cc & 0x7f];
+}
+
+/*
+ * Maps a controller to an action.
+ */
+int ccmap_set(ccmap_t *map, int channel, int cc, ccmap_action_t action, int arg)
+{
+	ccmap_entry_t *entry;
+	short control;
+	
+	if (channel < 0 || channel > 15 || cc < 0 || cc > 127)
+		return -1;
+	if (action >= CCMAP_LAST || (action != CCMAP_NONE && (arg < 0 || arg >= s_actions[action].count)))
+		return -1;
+	
+	control = channel * 128 + cc;
+	entry = &map->entries[channel][cc];
+	
+	/* remove the previous mapping of this controller */
+	if (entry->action != CCMAP_NONE && map->controls[entry->action][entry->arg] == control)
+		map->controls[entry->action][entry->arg] = -1;
+	
+	entry->action = action;
+	entry->arg = action != CCMAP_NONE ? arg : 0;
+	
+	if (action == CCMAP_NONE)
+		return 0;
+	
+	/* remove the previous controller of this action */
+	if (map->controls[action][arg] >= 0 && map->controls[action][arg] != control)
+		map->entries[map->controls[action][arg] / 128][map->controls[action][arg] % 128].action = CCMAP_NONE;
+	
+	map->controls[action][arg] = control;
+	
+	return 0;
+}
+
+/*
+ * Finds the controller mapped to an action.
+ */
+int ccmap_find(ccmap_t *map, ccmap_action_t action, int arg, int *channel, int *cc)
+{
+	short control;
+	
+	if (action >= CCMAP_LAST || arg < 0 || arg >= CCMAP_MAX_ARGS)
+		return -1;
+	
+	control = map->controls[action][arg];
+	if (control < 0)
+		return -1;
+	
+	*channel = control / 128;
+	*cc = control % 128;
+	
+	return 0;
+}
+
+/*
+ * Returns the number of arguments of an action.
+ */
+int ccmap_get_arg_count(ccmap_action_t action)
+{
+	return s_actions[action].count;
+}
+
+/*
+ * Returns the name of an action.
+ */
+const char *ccmap_get_action_name(ccmap_action_t action)
+{
+	return s_actions[action].name;
+}
+
+/*
+ * Loads a mapping file.
+ */
+int ccmap_load(ccmap_t *map, const char *filename)
+{
+	para_handle_t para;
+	char name[32];
+	int channel, cc, arg, count;
+	ccmap_action_t action;
+	int i, j, num;
+	int result = -1;
+	
+	para = para_new();
+	if (para == 0) {
+		LOG(LOG_ERROR, "cannot allocate para");
+		return -1;
+	}
+	
+	if (para_load_from_file(para, filename) != 0) {
+		LOG(LOG_ERROR, "cannot load cc map from '%s'", filename);
+		goto out;
+	}
+	
+	if (para_set_section(para, "ccmap") != 0 || para_get_child_section_count(para, &num) != 0) {
+		LOG(LOG_ERROR, "invalid cc map file '%s'", filename);
+		goto out;
+	}
+	
+	ccmap_clear(map);
+	
+	for (i = 0; i < num; i++) {
+		para_set_child_section_by_index(para, i);
+		
+		arg = 0;
+		count = 1;
+		if (para_read_string(para, "action", name, sizeof(name)) != 0 ||
+			para_read_int(para, "channel", &channel) != 0 ||
+			para_read_int(para, "cc", &cc) != 0) {
+			LOG(LOG_WARNING, "incomplete mapping %d in '%s'", i, filename);
+			para_set_parent_section(para);
+			continue;
+		}
+		para_read_int(para, "arg", &arg);
+		para_read_int(para, "count", &count);
+		para_set_parent_section(para);
+		
+		action = find_action(name);
+		if (action == CCMAP_NONE) {
+			LOG(LOG_WARNING, "unknown action '%s' in '%s'", name, filename);
+			continue;
+		}
+		
+		/* channels are numbered 1-16 in the file */
+		for (j = 0; j < count; j++)
+			if (ccmap_set(map, channel - 1, cc + j, action, arg + j) != 0)
+				LOG(LOG_WARNING, "invalid mapping %d in '%s'", i, filename);
+	}
+	
+	result = 0;
+	
+out:
+	para_free(para);
+	
+	return result;
+}
+
+/*
+ * Saves a mapping file.
+ */
+int ccmap_save(ccmap_t *map, const char *filename)
+{
+	para_handle_t para;
+	char name[16];
+	int action, arg, num = 0;
+	short control;
+	int result = -1;
+	
+	para = para_new();
+	if (para == 0) {
+		LOG(LOG_ERROR, "cannot allocate para");
+		return -1;
+	}
+	
+	para_create_section(para, "ccmap");
+	
+	for (action = CCMAP_NONE + 1; action < CCMAP_LAST; action++) {
+		for (arg = 0; arg < s_actions[action].count; arg++) {
+			control = map->controls[action][arg];
+			if (control < 0)
+				continue;
+			snprintf(name, sizeof(name), "map%d", num++);
+			para_create_child_section(para, name);
+			para_write_string(para, "action", s_actions[action].name);
+			para_write_int(para, "arg", arg);
+			para_write_int(para, "channel", control / 128 + 1);
+			para_write_int(para, "cc", control % 128);
+			para_set_parent_section(para);
+		}
+	}
+	
+	if (para_save_to_file(para, filename) != 0) {
+		LOG(LOG_ERROR, "cannot save cc map to '%s'", filename);
+		goto out;
+	}
+	
+	result = 0;
+	
+out:
+	para_free(para);
+	
+	return result;
+}
+
+/**
+ * Finds an action by name.
+ * @param name Action name
+ * @return Returns the action or CCMAP_NONE if not found.
+ */
+static ccmap_action_t find_action(const char *name)
+{
+	int i;
+	
+	for (i = CCMAP_NONE + 1; i < CCMAP_LAST; i++)
+		if (strcmp(s_actions[i].name, name) == 0)
+			return i;
+	
+	return CCMAP_NONE;
+}
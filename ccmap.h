@@ -0,0 +1,133 @@
+#ifndef __CCMAP_H__
+#define __CCMAP_H__
+
+/** maximum number of arguments of a single action */
+#define CCMAP_MAX_ARGS 32
+
+/** cc map actions */
+typedef enum {
+	CCMAP_NONE,
+	CCMAP_STEP_VALUE,           /**< arg: step */
+	CCMAP_STEP_MODE,            /**< arg: step */
+	CCMAP_LINE,                 /**< arg: line */
+	CCMAP_SEQUENCE,             /**< arg: sequence */
+	CCMAP_LINE_PARAM,           /**< arg: line parameter index */
+	CCMAP_GLOBAL_PARAM,         /**< arg: global parameter index */
+	CCMAP_BUTTON,               /**< arg: button (button_cc_t) */
+	CCMAP_LAST,
+} ccmap_action_t;
+
+/** cc buttons */
+typedef enum {
+	BUTTON_CC_F1,
+	BUTTON_CC_F2,
+	BUTTON_CC_F3,
+	BUTTON_CC_F4,
+	BUTTON_CC_PLAY,
+	BUTTON_CC_STOP,
+	BUTTON_CC_PREV,
+	BUTTON_CC_NEXT,
+	BUTTON_CC_LAST,
+} button_cc_t;
+
+/** cc map entry */
+typedef struct {
+	unsigned char action;
+	unsigned char arg;
+} ccmap_entry_t;
+
+/** cc map, maps (channel, cc) to an action and back */
+typedef struct {
+	ccmap_entry_t entries[16][128];
+	short controls[CCMAP_LAST][CCMAP_MAX_ARGS];   /**< channel * 128 + cc or -1 */
+} ccmap_t;
+
+/**
+ * Clears all mappings.
+ * @param map CC map
+ */
+void ccmap_clear(ccmap_t *map);
+
+/**
+ * Loads the default mapping (BCR2000 preset on channel 1).
+ * @param map CC map
+ */
+void ccmap_default(ccmap_t *map);
+
+/**
+ * Returns the entry for a controller.
+ * @param map CC map
+ * @param channel Midi channel (0-15)
+ * @param cc Midi cc (0-127)
+ * @return Returns the entry.
+ */
+ccmap_entry_t *ccmap_get(ccmap_t *map, int channel, int cc);
+
+/**
+ * Maps a controller to an action. Each action argument is mapped to at
+ * most one controller, a previous mapping of the same argument is removed.
+ * @param map CC map
+ * @param channel Midi channel (0-15)
+ * @param cc Midi cc (0-127)
+ * @param action Action
+ * @param arg Argument
+ * @return Returns 0 if successful.
+ */
+int ccmap_set(ccmap_t *map, int channel, int cc, ccmap_action_t action, int arg);
+
+/**
+ * Finds the controller mapped to an action.
+ * @param map CC map
+ * @param action Action
+ * @param arg Argument
+ * @param channel Midi channel
+ * @param cc Midi cc
+ * @return Returns 0 if the action is mapped.
+ */
+int ccmap_find(ccmap_t *map, ccmap_action_t action, int arg, int *channel, int *cc);
+
+/**
+ * Returns the number of arguments of an action.
+ * @param action Action
+ * @return Returns the number of arguments.
+ */
+int ccmap_get_arg_count(ccmap_action_t action);
+
+/**
+ * Returns the name of an action.
+ * @param action Action
+ * @return Returns the name of the action.
+ */
+const char *ccmap_get_action_name(ccmap_action_t action);
+
+/**
+ * Loads a mapping file. Existing mappings are cleared first. Each child
+ * section of the "ccmap" section maps a range of controllers:
+ *
+ * <ccmap>
+ *     <steps>
+ *         <string name="action" value="step_value"/>
+ *         <int name="arg" value="0"/>
+ *         <int name="count" value="32"/>
+ *         <int name="channel" value="1"/>
+ *         <int name="cc" value="1"/>
+ *     </steps>
+ * </ccmap>
+ *
+ * "arg" and "count" are optional and default to 0 and 1. Channels are
+ * numbered 1-16.
+ * @param map CC map
+ * @param filename Filename
+ * @return Returns 0 if successful.
+ */
+int ccmap_load(ccmap_t *map, const char *filename);
+
+/**
+ * Saves a mapping file.
+ * @param map CC map
+ * @param filename Filename
+ * @return Returns 0 if successful.
+ */
+int ccmap_save(ccmap_t *map, const char *filename);
+
+#endif /* __CCMAP_H__ */
@@ -52,6 +52,28 @@ int clk_get_pulse(clk_t *clk)
 	return clk->pulse;
 }
 
+/*
+ * Returns how late the current pulse is processed.
+ */
+long clk_get_lateness(clk_t *clk)
+{
+	/* time left over after the pulse was due */
+	return clk->us;
+}
+
+/*
+ * Returns the pulse position of an absolute timestamp.
+ */
+long long clk_get_pulse_pos(clk_t *clk, mio_timestamp_t timestamp)
+{
+	long long us;
+	
+	/* time relative to the last pulse */
+	us = (long long) (timestamp - clk->start_time) * 1000 - (long long) clk->total_us;
+	
+	return (long long) clk->pulse * 1000 + us * 1000 / clk->divider;
+}
+
 /*
  * Returns the elapsed time in milliseconds.
  */
@@ -44,6 +44,23 @@ void clk_update(clk_t *clk, clk_cb_t cb);
  */
 int clk_get_pulse(clk_t *clk);
 
+/**
+ * Returns how late the current pulse is processed. Only valid within the
+ * pulse callback.
+ * @param clk Clock
+ * @return Returns the lateness in us.
+ */
+long clk_get_lateness(clk_t *clk);
+
+/**
+ * Returns the pulse position of an absolute timestamp. Pulse n is at
+ * position n * 1000, positions in between are fractions of a pulse.
+ * @param clk Clock
+ * @param timestamp Timestamp
+ * @return Returns the pulse position in 1/1000 pulses.
+ */
+long long clk_get_pulse_pos(clk_t *clk, mio_timestamp_t timestamp);
+
 /**
  * Returns the elapsed time in milliseconds.
  * @param clk Clock
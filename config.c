@@ -1,7 +1,10 @@
 
 #include <stdio.h>
 
+#include <string.h>
+
 #include "log.h"
+#include "mio.h"
 #include "para.h"
 #include "config.h"
 
@@ -10,10 +13,24 @@
  */
 void config_default(config_t *config)
 {
-	config->control_input[0] = 0;
-	config->control_output[0] = 0;
+	strncpy(config->midi_backend, MIO_DEFAULT_BACKEND, sizeof(config->midi_backend));
+	config->rescan_interval = 2000;
+	config->window_width = 1280;
+	config->window_height = 500;
+	config->frame_rate = 60;
+	strncpy(config->renderer, "accelerated", sizeof(config->renderer));
+	config->headless = 0;
+	strncpy(config->snapshot_file, "snapshot%03d.bmp", sizeof(config->snapshot_file));
+	config->frame_log[0] = 0;
+	memset(config->surfaces, 0, sizeof(config->surfaces));
+	config->num_surfaces = 1;
 	config->seq_input[0] = 0;
 	config->seq_output[0] = 0;
+	config->transpose_channel = 0;
+	config->transpose_root = 60;
+	config->tap_file[0] = 0;
+	config->state_export[0] = 0;
+	strncpy(config->tap_format, "raw", sizeof(config->tap_format));
 }
 
 /*
@@ -22,6 +39,8 @@ void config_default(config_t *config)
 int config_load(config_t *config, const char *filename)
 {
 	para_handle_t para;
+	surface_config_t *surface;
+	int i, count;
 	int result = -1;
 	
 	/* create parameter object */
@@ -43,10 +62,47 @@ int config_load(config_t *config, const char *filename)
 		goto out;
 	}
 	
-	para_read_string(para, "control_input", config->control_input, sizeof(config->control_input));
-	para_read_string(para, "control_output", config->control_output, sizeof(config->control_output));
+	para_read_string(para, "midi_backend", config->midi_backend, sizeof(config->midi_backend));
+	para_read_int(para, "rescan_interval", &config->rescan_interval);
+	para_read_int(para, "window_width", &config->window_width);
+	para_read_int(para, "window_height", &config->window_height);
+	para_read_int(para, "frame_rate", &config->frame_rate);
+	para_read_string(para, "renderer", config->renderer, sizeof(config->renderer));
+	para_read_int(para, "headless", &config->headless);
+	para_read_string(para, "snapshot_file", config->snapshot_file, sizeof(config->snapshot_file));
+	para_read_string(para, "frame_log", config->frame_log, sizeof(config->frame_log));
+	
+	/* a single surface can be configured without a surface section */
+	surface = &config->surfaces[0];
+	para_read_string(para, "control_input", surface->input, sizeof(surface->input));
+	para_read_string(para, "control_output", surface->output, sizeof(surface->output));
+	para_read_string(para, "cc_map", surface->cc_map, sizeof(surface->cc_map));
+	para_read_string(para, "sysex_header", surface->sysex_header, sizeof(surface->sysex_header));
+	
+	/* read surface sections */
+	if (para_get_child_section_count(para, &count) == 0 && count > 0) {
+		if (count > MAX_SURFACES) {
+			LOG(LOG_WARNING, "only %d control surfaces supported", MAX_SURFACES);
+			count = MAX_SURFACES;
+		}
+		config->num_surfaces = count;
+		for (i = 0; i < count; i++) {
+			surface = &config->surfaces[i];
+			para_set_child_section_by_index(para, i);
+			para_read_string(para, "input", surface->input, sizeof(surface->input));
+			para_read_string(para, "output", surface->output, sizeof(surface->output));
+			para_read_string(para, "cc_map", surface->cc_map, sizeof(surface->cc_map));
+			para_read_string(para, "sysex_header", surface->sysex_header, sizeof(surface->sysex_header));
+			para_set_parent_section(para);
+		}
+	}
 	para_read_string(para, "seq_input", config->seq_input, sizeof(config->seq_input));
 	para_read_string(para, "seq_output", config->seq_output, sizeof(config->seq_output));
+	para_read_int(para, "transpose_channel", &config->transpose_channel);
+	para_read_int(para, "transpose_root", &config->transpose_root);
+	para_read_string(para, "tap_file", config->tap_file, sizeof(config->tap_file));
+	para_read_string(para, "tap_format", config->tap_format, sizeof(config->tap_format));
+	para_read_string(para, "state_export", config->state_export, sizeof(config->state_export));
 
 	result = 0;
 	
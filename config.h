@@ -1,12 +1,37 @@
 #ifndef __CONFIG_H__
 #define __CONFIG_H__
 
+/** maximum number of control surfaces */
+#define MAX_SURFACES 4
+
+/** control surface configuration */
+typedef struct {
+	char input[128];
+	char output[128];
+	char cc_map[128];
+	char sysex_header[32];     /**< hex bytes of the sysex dump header, empty to send CCs */
+} surface_config_t;
+
 /** application configuration */
 typedef struct {
-	char control_input[128];
-	char control_output[128];
+	char midi_backend[32];
+	int rescan_interval;       /**< interval of midi device rescans in ms, 0 to rescan on request only */
+	int window_width;          /**< initial window width */
+	int window_height;         /**< initial window height */
+	int frame_rate;            /**< maximum screen refresh rate in Hz, 0 for no limit */
+	char renderer[16];         /**< screen renderer, "accelerated" (gpu, falls back to software) or "software" */
+	int headless;              /**< render offscreen without opening a window */
+	char snapshot_file[128];   /**< printf pattern of screen snapshot files, numbered from 1 */
+	char frame_log[128];       /**< file the render time of each frame is written to, empty if unused */
+	surface_config_t surfaces[MAX_SURFACES];
+	int num_surfaces;
 	char seq_input[128];
 	char seq_output[128];
+	int transpose_channel;     /**< midi channel (1-16) of the transpose keyboard, 0 if unused */
+	int transpose_root;        /**< root note of the transpose keyboard */
+	char tap_file[128];
+	char tap_format[8];
+	char state_export[64];     /**< shared memory segment the playback state is exported to, empty if unused */
 } config_t;
 
 /**
@@ -1,11 +1,14 @@
 
-#include <unistd.h>
+#include <string.h>
 
 #include "log.h"
 #include "config.h"
 #include "mio.h"
 #include "mout.h"
+#include "mtap.h"
 #include "seq.h"
+#include "transpose.h"
+#include "vis.h"
 #include "mmi.h"
 #include "param.h"
 #include "core.h"
@@ -13,24 +16,38 @@
 static int s_terminate = 0;
 static config_t s_config;
 static mio_stream_t s_input, s_output;
+static mring_t s_input_ring;
 
 /*
  * Initializes the core.
  */
 int core_init(void)
+{
+	config_t config;
+	
+	/* load configuration */
+	config_default(&config);
+	if (config_load(&config, "config.xml") != 0)
+		return -1;
+	
+	return core_init_config(&config);
+}
+
+/*
+ * Initializes the core with the given configuration.
+ */
+int core_init_config(const config_t *config)
 {
 	int i, count;
 	mio_device_t *dev;
 	
+	s_config = *config;
+	
 	/* init parameter connection table */
 	param_init_param_connections();
 	
-	/* load configuration */
-	if (config_load(&s_config, "config.xml") != 0)
-		return -1;
-	
 	/* init midi io */
-	if (mio_init() != 0)
+	if (mio_init(s_config.midi_backend) != 0)
 		return -1;
 	
 	/* enumerate devices */
@@ -42,17 +59,34 @@ int core_init(void)
 	}
 		
 	/* open sequencer input/output */
-	if (mio_open_input(&s_input, mio_get_input_device_by_name(s_config.seq_input)) != 0)
+	if (mio_open_input(&s_input, s_config.seq_input) != 0)
 		return -1;
-	if (mio_open_output(&s_output, mio_get_output_device_by_name(s_config.seq_output), OUTPUT_LATENCY) != 0)
+	if (mio_open_output(&s_output, s_config.seq_output, OUTPUT_LATENCY) != 0)
 		return -1;
+	mring_init(&s_input_ring, &s_input);
+	
+	/* look for devices coming and going */
+	mio_set_rescan_interval(s_config.rescan_interval);
 		
 	/* init midi output */
 	if (mout_init() != 0)
 		return -1;
 		
 	mout_register_output(0, &s_output);
+	
+	/* start output capture */
+	if (s_config.tap_file[0])
+		if (mtap_open(s_config.tap_file, strcmp(s_config.tap_format, "smf") == 0 ? MTAP_FORMAT_SMF : MTAP_FORMAT_RAW) != 0)
+			return -1;
 		
+	/* init keyboard transpose */
+	transpose_init(s_config.transpose_channel, s_config.transpose_root);
+	
+	/* start state export, before the sequencer publishes its first state */
+	if (s_config.state_export[0])
+		if (vis_open(s_config.state_export) != 0)
+			return -1;
+	
 	/* init sequencer */
 	if (seq_init() != 0)
 		return -1;
@@ -73,8 +107,12 @@ void core_shutdown(void)
 	
 	seq_shutdown();
 	
+	vis_close();
+	
 	mout_shutdown();
 	
+	mtap_close();
+	
 	mio_close(&s_input);
 	mio_close(&s_output);
 		
@@ -86,10 +124,8 @@ void core_shutdown(void)
  */
 void core_run(void)
 {
-	while (!s_terminate) {
+	while (!s_terminate)
 		mmi_update();
-		usleep(1000);
-	}
 	
 	seq_stop();
 }
@@ -100,6 +136,7 @@ void core_run(void)
 void core_exit(void)
 {
 	s_terminate = 1;
+	mmi_wakeup();
 }
 
 /*
@@ -118,6 +155,14 @@ mio_stream_t *core_get_input(void)
 	return &s_input;
 }
 
+/*
+ * Returns the ring of events read from the default input stream.
+ */
+mring_t *core_get_input_ring(void)
+{
+	return &s_input_ring;
+}
+
 /*
  * Returns the default output stream.
  */
@@ -3,6 +3,7 @@
 
 #include "mio.h"
 #include "config.h"
+#include "mring.h"
 
 /**
  * Initializes the core.
@@ -10,6 +11,14 @@
  */
 int core_init(void);
 
+/**
+ * Initializes the core with the given configuration instead of the one
+ * in config.xml.
+ * @param config Configuration, copied
+ * @return Returns 0 if successful.
+ */
+int core_init_config(const config_t *config);
+
 /**
  * Shuts the core down.
  */
@@ -37,6 +46,12 @@ config_t *core_get_config(void);
  */
 mio_stream_t *core_get_input(void);
 
+/**
+ * Returns the ring of events read from the default input stream.
+ * @return Returns the input ring.
+ */
+mring_t *core_get_input_ring(void);
+
 /**
  * Returns the default output stream.
  * @return Returns the default output stream.
@@ -13,8 +13,14 @@
 /** number of steps in a line */
 #define NUM_STEPS           32
 
-/** number of sources */
-#define NUM_SOURCES         (NUM_LINES * 2)
+/** number of global parameters on the controller */
+#define NUM_GLOBAL_PARAMS   8
+
+/** number of sources (line outputs, synced line outputs, keyboard transpose) */
+#define NUM_SOURCES         (NUM_LINES * 2 + 1)
+
+/** source index of the keyboard transpose */
+#define SOURCE_TRANSPOSE    (NUM_LINES * 2)
 
 /* line modes */
 #define LINE_MODE_OFF       0
@@ -43,4 +49,10 @@
 #define SYNC_MODE_AUTO      0
 #define SYNC_MODE_MANUAL    1
 
+/* controller resolutions */
+#define CC_RES_7BIT         0
+#define CC_RES_14BIT        1
+#define CC_RES_NRPN         2
+#define CC_RES_BEND         3
+
 #endif /*__DEFINES_H__*/
@@ -2,7 +2,7 @@
 #define __FILEDEFS_H__
 
 #define FILE_MAGIC "ssq32pat"
-#define FILE_VERSION 0
+#define FILE_VERSION 1
 
 /** file header */
 typedef struct {
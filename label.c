@@ -0,0 +1,208 @@
+
+#include <stdio.h>
+#include <string.h>
+
+#include "SDL.h"
+#include "SDL2_gfxPrimitives.h"
+
+#include "log.h"
+#include "param.h"
+#include "label.h"
+
+/** width of a character in pixels */
+#define CHAR_WIDTH 8
+
+/** maximum length of a label */
+#define LABEL_LEN 128
+
+static label_t *find_label(label_cache_t *cache, int class, int value, int named);
+static int render_label(label_cache_t *cache, const char *str, SDL_Rect *rect);
+static void format_label(param_t *param, int named, char *str, int len);
+
+/*
+ * Initializes a label cache and creates its atlas texture.
+ */
+int label_cache_init(label_cache_t *cache, SDL_Renderer *renderer, SDL_Color color)
+{
+	cache->renderer = renderer;
+	cache->color = color;
+	cache->enabled = 1;
+	cache->hits = 0;
+	cache->misses = 0;
+	
+	/* text is rendered into the atlas, which is blended onto the cells */
+	cache->atlas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+		LABEL_ATLAS_WIDTH, LABEL_ATLAS_HEIGHT);
+	if (!cache->atlas) {
+		LOG(LOG_ERROR, "cannot create label atlas: %s", SDL_GetError());
+		return -1;
+	}
+	SDL_SetTextureBlendMode(cache->atlas, SDL_BLENDMODE_BLEND);
+	
+	label_cache_clear(cache);
+	
+	return 0;
+}
+
+/*
+ * Destroys the atlas texture of a label cache.
+ */
+void label_cache_free(label_cache_t *cache)
+{
+	label_cache_clear(cache);
+	if (cache->atlas) {
+		SDL_DestroyTexture(cache->atlas);
+		cache->atlas = NULL;
+	}
+}
+
+/*
+ * Forgets all cached labels.
+ */
+void label_cache_clear(label_cache_t *cache)
+{
+	int i;
+	
+	for (i = 0; i < LABEL_CACHE_SIZE; i++)
+		cache->labels[i].class = -1;
+	cache->count = 0;
+	cache->atlas_x = 0;
+	cache->atlas_y = 0;
+}
+
+/*
+ * Draws the label of a parameter value.
+ */
+void label_draw(label_cache_t *cache, int x, int y, int width, param_t *param, int named)
+{
+	char str[LABEL_LEN];
+	label_t *label;
+	SDL_Rect src, dst;
+	int class = param->class_def->class;
+	
+	if (width < CHAR_WIDTH)
+		return;
+	
+	if (!cache->enabled) {
+		format_label(param, named, str, sizeof(str));
+		if (strlen(str) > width / CHAR_WIDTH)
+			str[width / CHAR_WIDTH] = 0;
+		stringRGBA(cache->renderer, x, y, str, cache->color.r, cache->color.g, cache->color.b, cache->color.a);
+		return;
+	}
+	
+	label = find_label(cache, class, param->value, named);
+	if (label->class < 0) {
+		format_label(param, named, str, sizeof(str));
+		
+		/* keep the load factor at one half, a full cache or atlas starts over */
+		if (cache->count >= LABEL_CACHE_SIZE / 2 || render_label(cache, str, &label->rect) != 0) {
+			label_cache_clear(cache);
+			label = find_label(cache, class, param->value, named);
+			if (render_label(cache, str, &label->rect) != 0)
+				return;
+		}
+		label->class = class;
+		label->value = param->value;
+		label->named = named;
+		cache->count++;
+		cache->misses++;
+	} else {
+		cache->hits++;
+	}
+	
+	src = label->rect;
+	if (src.w > width)
+		src.w = width;
+	dst.x = x;
+	dst.y = y;
+	dst.w = src.w;
+	dst.h = src.h;
+	SDL_RenderCopy(cache->renderer, cache->atlas, &src, &dst);
+}
+
+/**
+ * Finds the cache entry of a label, or the free entry it is stored in.
+ * @param cache Label cache
+ * @param class Parameter class
+ * @param value Parameter value
+ * @param named Set if the label is prefixed with the parameter name
+ * @return Returns the cache entry.
+ */
+static label_t *find_label(label_cache_t *cache, int class, int value, int named)
+{
+	unsigned int index;
+	label_t *label;
+	
+	index = ((unsigned int) class * 2654435761u) ^ ((unsigned int) value * 40503u) ^ (unsigned int) named;
+	for (;;) {
+		label = &cache->labels[index & (LABEL_CACHE_SIZE - 1)];
+		if (label->class < 0 ||
+			(label->class == class && label->value == value && label->named == named))
+			return label;
+		index++;
+	}
+}
+
+/**
+ * Renders a label into the next free space of the atlas. The atlas is
+ * filled row by row, the space around the text is transparent.
+ * @param cache Label cache
+ * @param str Text
+ * @param rect Returns the position in the atlas
+ * @return Returns 0 if successful, -1 if the atlas is full.
+ */
+static int render_label(label_cache_t *cache, const char *str, SDL_Rect *rect)
+{
+	SDL_Renderer *renderer = cache->renderer;
+	SDL_Texture *target;
+	int w = strlen(str) * CHAR_WIDTH;
+	
+	if (w == 0)
+		w = 1;
+	if (w > LABEL_ATLAS_WIDTH)
+		w = LABEL_ATLAS_WIDTH;
+	
+	if (cache->atlas_x + w > LABEL_ATLAS_WIDTH) {
+		cache->atlas_x = 0;
+		cache->atlas_y += LABEL_HEIGHT;
+	}
+	if (cache->atlas_y + LABEL_HEIGHT > LABEL_ATLAS_HEIGHT)
+		return -1;
+	
+	rect->x = cache->atlas_x;
+	rect->y = cache->atlas_y;
+	rect->w = w;
+	rect->h = LABEL_HEIGHT;
+	cache->atlas_x += w;
+	
+	/* switching the target resets the clipping of the current target */
+	target = SDL_GetRenderTarget(renderer);
+	SDL_SetRenderTarget(renderer, cache->atlas);
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+	SDL_RenderFillRect(renderer, rect);
+	stringRGBA(renderer, rect->x, rect->y, str, cache->color.r, cache->color.g, cache->color.b, cache->color.a);
+	SDL_SetRenderTarget(renderer, target);
+	
+	return 0;
+}
+
+/**
+ * Formats the label of a parameter value.
+ * @param param Parameter
+ * @param named Set to prefix the label with the parameter name
+ * @param str String
+ * @param len Length of string
+ */
+static void format_label(param_t *param, int named, char *str, int len)
+{
+	char val[LABEL_LEN];
+	
+	if (named) {
+		param_get_str(param, val, sizeof(val));
+		snprintf(str, len, "%s: %s", param_get_name(param), val);
+	} else {
+		param_get_str(param, str, len);
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef __LABEL_H__
+#define __LABEL_H__
+
+#include "SDL.h"
+
+#include "param.h"
+
+/** number of cached labels, must be a power of two */
+#define LABEL_CACHE_SIZE 1024
+
+/** height of a label in pixels */
+#define LABEL_HEIGHT 8
+
+/* size of the texture the labels are rendered into */
+#define LABEL_ATLAS_WIDTH  1024
+#define LABEL_ATLAS_HEIGHT 512
+
+/** cached label */
+typedef struct {
+	int class;                 /**< parameter class, -1 if the entry is unused */
+	int value;                 /**< parameter value */
+	int named;                 /**< set if the label is prefixed with the parameter name */
+	SDL_Rect rect;             /**< position of the rendered label in the atlas */
+} label_t;
+
+/** cache of rendered parameter labels */
+typedef struct {
+	label_t labels[LABEL_CACHE_SIZE];
+	int count;
+	SDL_Renderer *renderer;    /**< renderer the labels are drawn with */
+	SDL_Texture *atlas;        /**< texture holding all labels, so that drawing them can be batched */
+	int atlas_x;               /**< next free position in the atlas */
+	int atlas_y;
+	SDL_Color color;           /**< text color */
+	int enabled;               /**< labels are formatted and drawn directly if not set */
+	unsigned long hits;
+	unsigned long misses;
+} label_cache_t;
+
+/**
+ * Initializes a label cache and creates its atlas texture.
+ * @param cache Label cache
+ * @param renderer Renderer the labels are drawn with
+ * @param color Text color
+ * @return Returns 0 if successful.
+ */
+int label_cache_init(label_cache_t *cache, SDL_Renderer *renderer, SDL_Color color);
+
+/**
+ * Destroys the atlas texture of a label cache.
+ * @param cache Label cache
+ */
+void label_cache_free(label_cache_t *cache);
+
+/**
+ * Forgets all cached labels, the atlas space is reused.
+ * @param cache Label cache
+ */
+void label_cache_clear(label_cache_t *cache);
+
+/**
+ * Draws the label of a parameter value to the current render target. The
+ * label is rendered into the atlas on first use and copied from there
+ * afterwards.
+ * @param cache Label cache
+ * @param x Position x
+ * @param y Position y
+ * @param width Maximum width, longer labels are cut off
+ * @param param Parameter
+ * @param named Set to prefix the label with the parameter name
+ */
+void label_draw(label_cache_t *cache, int x, int y, int width, param_t *param, int named);
+
+#endif /*__LABEL_H__*/
@@ -0,0 +1,85 @@
+
+#include <string.h>
+#include <time.h>
+
+#include "lat.h"
+
+/*
+ * Returns the time of a monotonic clock.
+ */
+long long lat_now(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/*
+ * Clears a latency histogram.
+ */
+void lat_clear(lat_hist_t *hist)
+{
+	memset(hist, 0, sizeof(lat_hist_t));
+}
+
+/*
+ * Adds a latency to a histogram.
+ */
+void lat_add(lat_hist_t *hist, long latency)
+{
+	int bucket = 0;
+	
+	if (latency < 0)
+		latency = 0;
+	
+	while (bucket < LAT_BUCKETS - 1 && (latency >> bucket) > 0)
+		bucket++;
+	
+	hist->buckets[bucket]++;
+	hist->count++;
+	if (latency > hist->max)
+		hist->max = latency;
+}
+
+/*
+ * Returns a percentile of the latencies in a histogram.
+ */
+long lat_get_percentile(lat_hist_t *hist, int percentile)
+{
+	unsigned int rank, sum = 0;
+	int bucket;
+	
+	if (hist->count == 0)
+		return 0;
+	
+	/* rank of the sample at the percentile, starting at 1 */
+	rank = ((unsigned long long) hist->count * percentile + 99) / 100;
+	if (rank < 1)
+		rank = 1;
+	
+	for (bucket = 0; bucket < LAT_BUCKETS; bucket++) {
+		sum += hist->buckets[bucket];
+		if (sum >= rank)
+			break;
+	}
+	
+	if (bucket == 0)
+		return 0;
+	if (bucket >= LAT_BUCKETS - 1 || (1L << bucket) - 1 > hist->max)
+		return hist->max;
+	
+	return (1L << bucket) - 1;
+}
+
+/*
+ * Returns the p50, p99 and maximum latency of a histogram.
+ */
+void lat_get_stats(lat_hist_t *hist, lat_stats_t *stats)
+{
+	stats->count = hist->count;
+	stats->p50 = lat_get_percentile(hist, 50);
+	stats->p99 = lat_get_percentile(hist, 99);
+	stats->max = hist->max;
+}
@@ -0,0 +1,58 @@
+#ifndef __LAT_H__
+#define __LAT_H__
+
+/** number of histogram buckets, bucket n counts latencies below 2^n us */
+#define LAT_BUCKETS 24
+
+/** latency histogram with power of two buckets */
+typedef struct {
+	unsigned int buckets[LAT_BUCKETS];
+	unsigned int count;
+	long max;                   /**< maximum latency in us */
+} lat_hist_t;
+
+/** latency statistics */
+typedef struct {
+	unsigned int count;
+	long p50;                   /**< median latency in us */
+	long p99;                   /**< 99th percentile latency in us */
+	long max;                   /**< maximum latency in us */
+} lat_stats_t;
+
+/**
+ * Returns the time of a monotonic clock.
+ * @return Returns the time in us.
+ */
+long long lat_now(void);
+
+/**
+ * Clears a latency histogram.
+ * @param hist Histogram
+ */
+void lat_clear(lat_hist_t *hist);
+
+/**
+ * Adds a latency to a histogram.
+ * @param hist Histogram
+ * @param latency Latency in us, negative values count as 0
+ */
+void lat_add(lat_hist_t *hist, long latency);
+
+/**
+ * Returns a percentile of the latencies in a histogram. The result is the
+ * upper bound of the bucket the percentile falls into, but never more than
+ * the maximum latency.
+ * @param hist Histogram
+ * @param percentile Percentile (0-100)
+ * @return Returns the latency in us.
+ */
+long lat_get_percentile(lat_hist_t *hist, int percentile);
+
+/**
+ * Returns the p50, p99 and maximum latency of a histogram.
+ * @param hist Histogram
+ * @param stats Returns the statistics
+ */
+void lat_get_stats(lat_hist_t *hist, lat_stats_t *stats);
+
+#endif /*__LAT_H__*/
@@ -5,10 +5,15 @@
 #include "param.h"
 #include "mout.h"
 #include "line.h"
+#include "transpose.h"
 
 static void do_step(line_t *line, mio_timestamp_t timestamp);
+static int get_next_step(line_t *line, int step, int *direction);
+static int peek_next_step(line_t *line);
 static void start_step(line_t *line, mio_timestamp_t timestamp);
 static void stop_step(line_t *line, mio_timestamp_t timestamp);
+static void slew_step(line_t *line, int gate, mio_timestamp_t timestamp);
+static int get_ctrl_value(int value);
 static int get_line_output(line_t *line, int step);
 static int get_param(line_t *line, param_t *param);
 static void line_mode_changed(param_t *param);
@@ -42,6 +47,8 @@ void line_init(line_t *line, int index, sequence_t *sequence)
 	param_init(&line->midi_cc, PARAM_CLASS_MIDI_CC, line, 0);
 	param_init(&line->velocity, PARAM_CLASS_VELOCITY, line, PARAM_FLAG_CAN_CONNECT);
 	param_init(&line->add, PARAM_CLASS_ADD, line, PARAM_FLAG_CAN_CONNECT);
+	param_init(&line->slew, PARAM_CLASS_SLEW, line, 0);
+	param_init(&line->cc_res, PARAM_CLASS_CC_RES, line, 0);
 	
 	line->line_mode_changed = NULL;
 	line->first_last_changed = NULL;
@@ -64,6 +71,9 @@ void line_reset(line_t *line)
 	line->cur_step = -1;
 	line->prev_step = -1;
 	line->direction = 1;
+	line->kept = 0;
+	line->slew_from = 0;
+	line->slew_to = 0;
 };
 
 /*
@@ -75,15 +85,95 @@ void line_pulse(line_t *line, int pulse, mio_timestamp_t timestamp)
 	int length = get_param(line, &line->length);
 	
 	if ((line->pulses % gate) == 0) {
+		line->prev_step = line->cur_step;
 		do_step(line, timestamp);
 		line->pulses = 1;
 	} else {
 		line->pulses++;
 		if (line->pulses >= length)
 			stop_step(line, timestamp);
+		slew_step(line, gate, timestamp);
 	}
 }
 
+/*
+ * Returns the step nearest to a pulse position.
+ */
+int line_get_nearest_step(line_t *line, long long pos, int pulse, int *ahead)
+{
+	int gate = get_param(line, &line->gate);
+	long long offset;
+	int step = line->cur_step;
+	
+	if (ahead)
+		*ahead = 0;
+	
+	if (line->cur_step < 0)
+		return -1;
+	
+	/* offset to the start of the current step */
+	offset = pos - (long long) (pulse - (line->pulses - 1)) * 1000;
+	
+	if (offset >= gate * 500LL) {
+		step = peek_next_step(line);
+		if (ahead)
+			*ahead = step != line->cur_step;
+	} else if (offset < -gate * 500LL && line->prev_step >= 0) {
+		step = line->prev_step;
+	}
+	
+	return step;
+}
+
+/*
+ * Returns the length of the steps of a line.
+ */
+int line_get_gate(line_t *line)
+{
+	return get_param(line, &line->gate);
+}
+
+/*
+ * Records a value into a step and switches the step on.
+ */
+void line_record_step(line_t *line, int step, int value)
+{
+	switch (get_param(line, &line->line_mode)) {
+	case LINE_MODE_NOTE:
+		value -= get_param(line, &line->note) + get_param(line, &line->add);
+		break;
+	case LINE_MODE_VEL:
+	case LINE_MODE_ADD:
+	case LINE_MODE_CTRL:
+		value -= get_param(line, &line->add);
+		break;
+	}
+	
+	param_set(&line->step_values[step], value);
+	param_set(&line->step_modes[step], STEP_MODE_ON);
+}
+
+/*
+ * Keeps a step from being cleared once.
+ */
+void line_keep_step(line_t *line, int step)
+{
+	line->kept |= 1u << step;
+}
+
+/*
+ * Clears a step by switching it off.
+ */
+void line_clear_step(line_t *line, int step)
+{
+	if (line->kept & (1u << step)) {
+		line->kept &= ~(1u << step);
+		return;
+	}
+	
+	param_set(&line->step_modes[step], STEP_MODE_OFF);
+}
+
 /*
  * Loads a line from a file.
  */
@@ -104,6 +194,10 @@ int line_load(line_t *line, FILE *file, int version)
 	param_load(&line->midi_cc, file);
 	param_load(&line->velocity, file);
 	param_load(&line->add, file);
+	if (version >= 1) {
+		param_load(&line->slew, file);
+		param_load(&line->cc_res, file);
+	}
 	
 	/* load step parameters */
 	for (i = 0; i < NUM_STEPS; i++)
@@ -135,6 +229,8 @@ int line_save(line_t *line, FILE *file, int version)
 	param_save(&line->midi_cc, file);
 	param_save(&line->velocity, file);
 	param_save(&line->add, file);
+	param_save(&line->slew, file);
+	param_save(&line->cc_res, file);
 	
 	/* save step parameters */
 	for (i = 0; i < NUM_STEPS; i++)
@@ -152,6 +248,29 @@ int line_save(line_t *line, FILE *file, int version)
  * @param timestamp Timestamp
  */
 static void do_step(line_t *line, mio_timestamp_t timestamp)
+{
+	line->cur_step = get_next_step(line, line->cur_step, &line->direction);
+	
+	/* check if we should skip that step */
+	/* FIXME this could be blocking if all steps are skipped */
+	if (param_get_enum(&line->step_modes[line->cur_step]) == STEP_MODE_SKIP)
+		do_step(line, timestamp);
+		
+	/* get current output */
+	param_set(&line->output, get_line_output(line, line->cur_step));
+
+	/* trigger a step */		
+	start_step(line, timestamp);
+}
+
+/**
+ * Computes the step following the given step according to the play mode.
+ * @param line Line
+ * @param step Current step
+ * @param direction Current direction, updated to the new direction
+ * @return Returns the next step.
+ */
+static int get_next_step(line_t *line, int step, int *direction)
 {
 	int play_mode = get_param(line, &line->play_mode);
 	int first = get_param(line, &line->first_step);
@@ -159,64 +278,80 @@ static void do_step(line_t *line, mio_timestamp_t timestamp)
 	
 	switch (play_mode) {
 	case PLAY_MODE_FWD:
-		line->direction = 1;
-		line->cur_step++;
-		if (line->cur_step > last)
-			line->cur_step = first;
+		*direction = 1;
+		step++;
+		if (step > last)
+			step = first;
 		break;
 	case PLAY_MODE_BWD:
-		line->direction = -1;
-		line->cur_step--;
-		if (line->cur_step < first)
-			line->cur_step = last;
+		*direction = -1;
+		step--;
+		if (step < first)
+			step = last;
 		break;
 	case PLAY_MODE_PINGPONG:
-		line->cur_step += line->direction;
-		if (line->direction > 0) {
-			if (line->cur_step > last) {
-				line->direction = -1;
-				line->cur_step = last - 1;
+		step += *direction;
+		if (*direction > 0) {
+			if (step > last) {
+				*direction = -1;
+				step = last - 1;
 			}
 		} else {
-			if (line->cur_step < first) {
-				line->direction = 1;
-				line->cur_step = first + 1;
+			if (step < first) {
+				*direction = 1;
+				step = first + 1;
 			}
 		}
 		break;
 	case PLAY_MODE_FWD_BWD:
-		line->cur_step += line->direction;
-		if (line->direction > 0) {
-			if (line->cur_step > last) {
-				line->direction = -1;
-				line->cur_step = last;
+		step += *direction;
+		if (*direction > 0) {
+			if (step > last) {
+				*direction = -1;
+				step = last;
 			}
 		} else {
-			if (line->cur_step < first) {
-				line->direction = 1;
-				line->cur_step = first;
+			if (step < first) {
+				*direction = 1;
+				step = first;
 			}
 		}
 		break;
 	case PLAY_MODE_RANDOM:
-		line->cur_step = first + random() % (last - first + 1);
+		step = first + random() % (last - first + 1);
 		break;
 	}
 	
 	/* make sure step is in the first-last interval */
-	line->cur_step = line->cur_step < first ? first : line->cur_step;
-	line->cur_step = line->cur_step > last ? last : line->cur_step;
+	step = step < first ? first : step;
+	step = step > last ? last : step;
 	
-	/* check if we should skip that step */
-	/* FIXME this could be blocking if all steps are skipped */
-	if (param_get_enum(&line->step_modes[line->cur_step]) == STEP_MODE_SKIP)
-		do_step(line, timestamp);
-		
-	/* get current output */
-	param_set(&line->output, get_line_output(line, line->cur_step));
+	return step;
+}
 
-	/* trigger a step */		
-	start_step(line, timestamp);
+/**
+ * Looks ahead to the step that will be played after the current step,
+ * without changing the line's state. Random play mode has no predictable
+ * next step, so the current step is returned.
+ * @param line Line
+ * @return Returns the next step.
+ */
+static int peek_next_step(line_t *line)
+{
+	int step = line->cur_step;
+	int direction = line->direction;
+	int i;
+	
+	if (get_param(line, &line->play_mode) == PLAY_MODE_RANDOM)
+		return step;
+	
+	for (i = 0; i < NUM_STEPS; i++) {
+		step = get_next_step(line, step, &direction);
+		if (param_get_enum(&line->step_modes[step]) != STEP_MODE_SKIP)
+			break;
+	}
+	
+	return step;
 }
 
 /**
@@ -231,11 +366,17 @@ static void start_step(line_t *line, mio_timestamp_t timestamp)
 	int midi_port = get_param(line, &line->midi_port);
 	int id = midi_port / 16;
 	int channel = midi_port % 16;
-	int note, vel, cc, value;
+	int note, vel, cc, value, res;
 	mout_note_t *new_note;
 	
 	switch (line_mode) {
 	case LINE_MODE_NOTE:
+		/* steps which are off only stop the previous note */
+		if (param_get_enum(&line->step_modes[line->cur_step]) == STEP_MODE_OFF) {
+			mout_stop_note(line->played_note, timestamp + 1);
+			line->played_note = NULL;
+			break;
+		}
 		note = get_param(line, &line->output);
 		vel = get_param(line, &line->velocity);
 		new_note = mout_play_note(id, channel, note, vel, timestamp);
@@ -245,8 +386,14 @@ static void start_step(line_t *line, mio_timestamp_t timestamp)
 	case LINE_MODE_CTRL:
 		cc = get_param(line, &line->midi_cc);
 		value = get_param(line, &line->output);
+		res = get_param(line, &line->cc_res);
 		LOG(LOG_INFO, "set cc %d to %d", cc, value);
-		mout_set_cc(id, channel, cc, value, timestamp);
+		line->slew_from = get_ctrl_value(value);
+		if (get_param(line, &line->slew))
+			line->slew_to = get_ctrl_value(get_line_output(line, peek_next_step(line)));
+		else
+			line->slew_to = line->slew_from;
+		mout_set_ctrl(id, channel, res, cc, line->slew_from, timestamp, 0);
 		break;
 	}
 }
@@ -270,6 +417,49 @@ static void stop_step(line_t *line, mio_timestamp_t timestamp)
 	}
 }
 
+/**
+ * Outputs an interpolated controller value between the current and the next
+ * step if slew is enabled. Interpolated values are optional and are dropped
+ * by mout if the port's message rate budget is exhausted.
+ * @param line Line
+ * @param gate Length of the current step in pulses
+ * @param timestamp Timestamp
+ */
+static void slew_step(line_t *line, int gate, mio_timestamp_t timestamp)
+{
+	int midi_port, slew, elapsed, value;
+	
+	if (get_param(line, &line->line_mode) != LINE_MODE_CTRL)
+		return;
+	
+	slew = get_param(line, &line->slew);
+	if (!slew || line->slew_from == line->slew_to)
+		return;
+	
+	/* pulses elapsed since the step started */
+	elapsed = line->pulses - 1;
+	if ((elapsed % slew) != 0)
+		return;
+	
+	value = line->slew_from + (line->slew_to - line->slew_from) * elapsed / gate;
+	midi_port = get_param(line, &line->midi_port);
+	mout_set_ctrl(midi_port / 16, midi_port % 16, get_param(line, &line->cc_res),
+		get_param(line, &line->midi_cc), value, timestamp, 1);
+}
+
+/**
+ * Converts a line output to a 14 bit controller value.
+ * @param value Line output
+ * @return Returns the 14 bit controller value.
+ */
+static int get_ctrl_value(int value)
+{
+	value = value < 0 ? 0 : value;
+	value = value > 127 ? 127 : value;
+	
+	return value << 7;
+}
+
 static int get_line_output(line_t *line, int step)
 {
 	int line_mode = get_param(line, &line->line_mode);
@@ -305,6 +495,14 @@ static int get_param(line_t *line, param_t *param)
 
 	if (param_is_connected(param)) {
 		index  = param_get_connected_index(param);
+		
+		/* keyboard transpose is an offset like an add line */
+		if (index == SOURCE_TRANSPOSE) {
+			if (param_is_valid_connection(param->class_def->class, PARAM_CLASS_ADD))
+				return transpose_get();
+			return param_get_default_value(param);
+		}
+		
 		sync = index / NUM_LINES;
 		index %= NUM_LINES;
 		step = (line->cur_step + NUM_STEPS) % NUM_STEPS;
@@ -402,6 +600,8 @@ static void set_line_mode(line_t *line, int mode)
 	case LINE_MODE_CTRL:
 		line->params[7] = &line->midi_cc;
 		line->params[8] = &line->midi_port;
+		line->params[9] = &line->slew;
+		line->params[10] = &line->cc_res;
 		line->params[15] = &line->add;
 		set_steps_class(line, PARAM_CLASS_ADD);
 		break;
@@ -29,6 +29,48 @@ void line_reset(line_t *line);
  */
 void line_pulse(line_t *line, int pulse, mio_timestamp_t timestamp);
 
+/**
+ * Returns the step nearest to a pulse position.
+ * @param line Line
+ * @param pos Pulse position in 1/1000 pulses
+ * @param pulse Last processed pulse
+ * @param ahead Set to 1 if the step is ahead of the playhead (may be NULL)
+ * @return Returns the nearest step or -1 if the line has not started.
+ */
+int line_get_nearest_step(line_t *line, long long pos, int pulse, int *ahead);
+
+/**
+ * Returns the length of the steps of a line, which may be modulated.
+ * @param line Line
+ * @return Returns the length in pulses.
+ */
+int line_get_gate(line_t *line);
+
+/**
+ * Records a value into a step and switches the step on. The value is
+ * converted so that the line outputs it at that step.
+ * @param line Line
+ * @param step Step number
+ * @param value Output value (e.g. note number)
+ */
+void line_record_step(line_t *line, int step, int value);
+
+/**
+ * Keeps a step from being cleared by the next line_clear_step(), e.g. a step
+ * recorded ahead of the playhead. Marks are dropped when the line is reset.
+ * @param line Line
+ * @param step Step number
+ */
+void line_keep_step(line_t *line, int step);
+
+/**
+ * Clears a step by switching it off. A kept step is left as is, only its
+ * mark is removed.
+ * @param line Line
+ * @param step Step number
+ */
+void line_clear_step(line_t *line, int step);
+
 /**
  * Loads a line from a file.
  * @param line Line
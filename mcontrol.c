@@ -1,16 +1,23 @@
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "log.h"
+#include "seq.h"
 #include "mcontrol.h"
 
-static void process_midi_event(mctrl_t *mctrl, mio_event_t *event);
-static void process_midi_cc(mctrl_t *mctrl, mio_event_t *event);
+static void process_midi_event(mctrl_t *mctrl, const mio_event_t *event);
+static void measure_latency(mctrl_t *mctrl, long long read_time);
+static void process_midi_cc(mctrl_t *mctrl, const mio_event_t *event);
+static void process_sysex(mctrl_t *mctrl, const mio_event_t *event);
+static void process_dump(mctrl_t *mctrl, const unsigned char *data, int len);
+static int write_values(mctrl_t *mctrl, short *controls, int count, mio_timestamp_t timestamp);
+static void commit_values(mctrl_t *mctrl, short *controls, int count, int result);
 
 /*
  * Initializes a midi controller.
  */
-int mctrl_init(mctrl_t *mctrl, mio_device_t *input, mio_device_t *output)
+int mctrl_init(mctrl_t *mctrl, const char *input, const char *output)
 {
 	if (mio_open_input(&mctrl->input, input) != 0) {
 		LOG(LOG_ERROR, "cannot open input stream for midi controller");
@@ -22,7 +29,25 @@ int mctrl_init(mctrl_t *mctrl, mio_device_t *input, mio_device_t *output)
 		return -1;
 	}
 	
+	mring_init(&mctrl->ring, &mctrl->input);
+	mctrl->subscriber = mring_subscribe(&mctrl->ring);
+	
 	mctrl->callbacks.cc_changed = NULL;
+	mctrl->callbacks.sysex_received = NULL;
+	
+	memset(mctrl->shadow, 0xff, sizeof(mctrl->shadow));
+	memset(mctrl->values, 0xff, sizeof(mctrl->values));
+	memset(mctrl->queued, 0, sizeof(mctrl->queued));
+	mctrl->num_dirty = 0;
+	mctrl->last_flush = mio_get_timestamp();
+	mctrl->credit = MCTRL_BURST * 1000;
+	mctrl->sysex_len = 0;
+	mctrl->dump_header_len = 0;
+	mctrl->generation = mio_get_generation(&mctrl->output);
+	lat_clear(&mctrl->dispatch_latency);
+	lat_clear(&mctrl->engine_latency);
+	mctrl->probe = 0;
+	mctrl->probe_input = 0;
 	
 	return 0;
 }
@@ -47,50 +72,297 @@ mctrl_callbacks_t *mctrl_get_callbacks(mctrl_t *mctrl)
 /*
  * Updates the midi controller by parsing incoming messages.
  */
-void mctrl_update(mctrl_t *mctrl)
+int mctrl_update(mctrl_t *mctrl)
 {
-	int i, count;
-	mio_event_t buf[MIO_BUF_LEN];
+	const mio_event_t *events;
+	int i, n, count = 0;
+	long long visible;
+	
+	/* the sequencer has seen the changes of previous updates */
+	if (mctrl->probe_input && (visible = __atomic_load_n(&mctrl->probe, __ATOMIC_ACQUIRE))) {
+		lat_add(&mctrl->engine_latency, visible - mctrl->probe_input);
+		mctrl->probe_input = 0;
+	}
+	
+	mring_fill(&mctrl->ring);
+	
+	/* events are processed in place, at most twice if the ring wraps */
+	while ((n = mring_peek(&mctrl->ring, mctrl->subscriber, &events)) > 0) {
+		for (i = 0; i < n; i++)
+			process_midi_event(mctrl, &events[i]);
+		mring_consume(&mctrl->ring, mctrl->subscriber, n);
+		count += n;
+	}
+	
+	return count;
+}
 
-	count = mio_read(&mctrl->input, buf, MIO_BUF_LEN);
-	if (count < 1)
-		return;
+/*
+ * Sets a cc controller value.
+ */
+void mctrl_cc_set(mctrl_t *mctrl, int channel, int cc, int value)
+{
+	mctrl->values[channel][cc] = value;
+	
+	if (!mctrl->queued[channel][cc]) {
+		mctrl->queued[channel][cc] = 1;
+		mctrl->dirty[mctrl->num_dirty++] = channel * 128 + cc;
+	}
+}
 
-	for (i = 0; i < count; i++)
-		process_midi_event(mctrl, &buf[i]);
+/*
+ * Sets the header of sysex value dumps.
+ */
+int mctrl_set_dump_header(mctrl_t *mctrl, const unsigned char *header, int len)
+{
+	if (len > MCTRL_DUMP_HEADER_LEN)
+		return -1;
+	
+	memcpy(mctrl->dump_header, header, len);
+	mctrl->dump_header_len = len;
+	
+	return 0;
 }
 
 /*
- * Sets a cc controller value.
+ * Sends a complete dump of all controller values.
  */
-void mctrl_cc_set(mctrl_t *mctrl, int cc, int value)
+int mctrl_send_dump(mctrl_t *mctrl)
 {
-	mio_event_t event;
+	short controls[16 * 128];
+	int i, count = 0;
+	
+	for (i = 0; i < 16 * 128; i++)
+		if (mctrl->values[i / 128][i % 128] != 0xff)
+			controls[count++] = i;
 	
-	event.message = mio_message(MIO_CMD_CONTROL_CHANGE, 0, cc, value);
-	event.timestamp = mio_get_timestamp();
+	return write_values(mctrl, controls, count, mio_get_timestamp());
+}
 
-	mio_write(&mctrl->output, &event, 1);
+/*
+ * Sends a sysex message to the controller.
+ */
+int mctrl_send_sysex(mctrl_t *mctrl, const unsigned char *data, int len)
+{
+	return mio_write_sysex(&mctrl->output, data, len, mio_get_timestamp());
 }
 
+/*
+ * Sends all changed controller values in a single write.
+ */
+int mctrl_flush(mctrl_t *mctrl)
+{
+	short controls[MCTRL_BURST];
+	mio_timestamp_t now = mio_get_timestamp();
+	mio_timestamp_t elapsed;
+	int i, j, channel, cc;
+	int count = 0;
+	
+	/* a reconnected controller shows nothing we sent before */
+	if (mio_get_generation(&mctrl->output) != mctrl->generation) {
+		mctrl->generation = mio_get_generation(&mctrl->output);
+		memset(mctrl->shadow, 0xff, sizeof(mctrl->shadow));
+		for (i = 0; i < 16 * 128; i++)
+			if (mctrl->values[i / 128][i % 128] != 0xff)
+				mctrl_cc_set(mctrl, i / 128, i % 128, mctrl->values[i / 128][i % 128]);
+	}
+	
+	/* refill credit, the time is clamped to what a full refill takes so that it cannot overflow */
+	elapsed = now - mctrl->last_flush;
+	if (elapsed > MCTRL_BURST * 1000 / MCTRL_RATE)
+		elapsed = MCTRL_BURST * 1000 / MCTRL_RATE;
+	if (elapsed > 0) {
+		mctrl->credit += elapsed * MCTRL_RATE;
+		if (mctrl->credit > MCTRL_BURST * 1000)
+			mctrl->credit = MCTRL_BURST * 1000;
+	}
+	mctrl->last_flush = now;
+	
+	if (mctrl->num_dirty == 0)
+		return 0;
+	
+	for (i = 0, j = 0; i < mctrl->num_dirty; i++) {
+		channel = mctrl->dirty[i] / 128;
+		cc = mctrl->dirty[i] % 128;
+		
+		if (mctrl->values[channel][cc] != mctrl->shadow[channel][cc]) {
+			/* keep the control queued if over the limit */
+			if (count >= mctrl->credit / 1000) {
+				mctrl->dirty[j++] = mctrl->dirty[i];
+				continue;
+			}
+			controls[count++] = mctrl->dirty[i];
+		}
+		
+		mctrl->queued[channel][cc] = 0;
+	}
+	
+	mctrl->num_dirty = j;
+	mctrl->credit -= count * 1000;
+	
+	/* values which could not be written are queued again */
+	if (count > 0 && write_values(mctrl, controls, count, now) != 0)
+		return 0;
+	
+	return count;
+}
+
+/*
+ * Returns the time until a flush can send the next queued value.
+ */
+int mctrl_get_flush_delay(mctrl_t *mctrl)
+{
+	int missing = 1000 - mctrl->credit;
+	
+	if (mctrl->num_dirty == 0)
+		return -1;
+	
+	/* at least a ms, a flush which failed to write must not be retried right away */
+	if (missing <= 0)
+		return 1;
+	
+	return (missing + MCTRL_RATE - 1) / MCTRL_RATE;
+}
+
+/*
+ * Returns the input latency statistics of a midi controller.
+ */
+void mctrl_get_latency(mctrl_t *mctrl, lat_stats_t *dispatch, lat_stats_t *engine)
+{
+	lat_get_stats(&mctrl->dispatch_latency, dispatch);
+	lat_get_stats(&mctrl->engine_latency, engine);
+}
+
+/**
+ * Writes controller values, either as CCs in a single write or as sysex
+ * dumps, and updates the shadow state of the values which were written.
+ * @param mctrl Midi controller
+ * @param controls Controls (channel * 128 + cc)
+ * @param count Number of controls
+ * @param timestamp Timestamp
+ * @return Returns 0 if successful.
+ */
+static int write_values(mctrl_t *mctrl, short *controls, int count, mio_timestamp_t timestamp)
+{
+	mio_event_t buf[MCTRL_BURST];
+	unsigned char *dump = mctrl->dump;
+	int max_len = MIO_SYSEX_LEN - 1;
+	int i, channel, cc, value, len, n = 0;
+	int first = 0, written;
+	int result = 0;
+	
+	len = 0;
+	for (i = 0; i < count; i++) {
+		channel = controls[i] / 128;
+		cc = controls[i] % 128;
+		value = mctrl->values[channel][cc];
+		
+		if (mctrl->dump_header_len == 0) {
+			buf[n].message = mio_message(MIO_CMD_CONTROL_CHANGE, channel, cc, value);
+			buf[n].timestamp = timestamp;
+			if (++n == MCTRL_BURST || i == count - 1) {
+				written = mio_write(&mctrl->output, buf, n);
+				commit_values(mctrl, &controls[first], i + 1 - first, written);
+				result |= written;
+				first = i + 1;
+				n = 0;
+			}
+			continue;
+		}
+		
+		/* start a new dump */
+		if (len == 0) {
+			dump[len++] = MIO_SYSEX_START;
+			memcpy(&dump[len], mctrl->dump_header, mctrl->dump_header_len);
+			len += mctrl->dump_header_len;
+		}
+		dump[len++] = channel;
+		dump[len++] = cc;
+		dump[len++] = value;
+		
+		/* send the dump if full or done */
+		if (len + 3 > max_len || i == count - 1) {
+			dump[len++] = MIO_SYSEX_END;
+			written = mio_write_sysex(&mctrl->output, dump, len, timestamp);
+			commit_values(mctrl, &controls[first], i + 1 - first, written);
+			result |= written;
+			first = i + 1;
+			len = 0;
+		}
+	}
+	
+	return result;
+}
+
+/**
+ * Updates the shadow state after controller values have been written. Values
+ * whose write failed are queued again, so that the next flush retries them.
+ * @param mctrl Midi controller
+ * @param controls Controls (channel * 128 + cc)
+ * @param count Number of controls
+ * @param result Result of the write
+ */
+static void commit_values(mctrl_t *mctrl, short *controls, int count, int result)
+{
+	int i, channel, cc;
+	
+	for (i = 0; i < count; i++) {
+		channel = controls[i] / 128;
+		cc = controls[i] % 128;
+		if (result == 0)
+			mctrl->shadow[channel][cc] = mctrl->values[channel][cc];
+		else
+			mctrl_cc_set(mctrl, channel, cc, mctrl->values[channel][cc]);
+	}
+}
 
 /**
  * Process a single midi event.
  * @param mctrl Midi controller
  * @param event Midi event
  */
-static void process_midi_event(mctrl_t *mctrl, mio_event_t *event)
+static void process_midi_event(mctrl_t *mctrl, const mio_event_t *event)
 {
+	int status = mio_message_status(event->message);
+	
+	measure_latency(mctrl, mring_get_read_time(&mctrl->ring, event));
+	
+	/* sysex data continues until the next status byte, the end byte may start an event of its own */
+	if (status == MIO_SYSEX_START ||
+		((status < 0x80 || status == MIO_SYSEX_END) && mctrl->sysex_len != 0)) {
+		process_sysex(mctrl, event);
+		return;
+	}
+	
+	/* real-time messages may be interleaved with sysex data */
+	if (status >= 0xf8)
+		return;
+	
+	mctrl->sysex_len = 0;
+	
 	if (mio_message_cmd(event->message) == MIO_CMD_CONTROL_CHANGE)
 		process_midi_cc(mctrl, event);
 }
 
+/**
+ * Adds the time since an event was read to the dispatch latency. The read
+ * time is used rather than the event timestamp, which only has ms
+ * resolution.
+ * @param mctrl Midi controller
+ * @param read_time Time the event was read, see mring_get_read_time()
+ */
+static void measure_latency(mctrl_t *mctrl, long long read_time)
+{
+	lat_add(&mctrl->dispatch_latency, lat_now() - read_time);
+	mctrl->event_input = read_time;
+}
+
 /**
  * Process a single midi CC event.
  * @param mctrl Midi controller
  * @param event Midi event
  */
-static void process_midi_cc(mctrl_t *mctrl, mio_event_t *event)
+static void process_midi_cc(mctrl_t *mctrl, const mio_event_t *event)
 {
 	int channel;
 	int cc;
@@ -100,9 +372,74 @@ static void process_midi_cc(mctrl_t *mctrl, mio_event_t *event)
 	cc = mio_message_data1(event->message);
 	value = mio_message_data2(event->message);
 	
-	if (mctrl->callbacks.cc_changed)
-		mctrl->callbacks.cc_changed(mctrl, cc, value);
+	/* the controller shows the value it sent */
+	mctrl->shadow[channel][cc] = value;
+	
+	if (mctrl->callbacks.cc_changed) {
+		mctrl->callbacks.cc_changed(mctrl, channel, cc, value);
+		
+		/* let the sequencer tell when it has seen the change, the engine
+		 * latency is measured from the oldest change a probe covers */
+		if (!mctrl->probe_input) {
+			mctrl->probe = 0;
+			if (seq_post_probe(&mctrl->probe) == 0)
+				mctrl->probe_input = mctrl->event_input;
+		}
+	}
 	
 //	LOG(LOG_INFO, "cc received (cc: %d value: %d)", cc, value);
 }
 
+/**
+ * Reassembles sysex data into the preallocated sysex buffer. Messages
+ * exceeding the buffer are dropped.
+ * @param mctrl Midi controller
+ * @param event Midi event carrying up to 4 bytes of sysex data
+ */
+static void process_sysex(mctrl_t *mctrl, const mio_event_t *event)
+{
+	int i, byte;
+	
+	for (i = 0; i < 4; i++) {
+		byte = mio_message_byte(event->message, i);
+		
+		if (byte == MIO_SYSEX_START)
+			mctrl->sysex_len = 0;
+		else if (byte >= 0x80 && byte != MIO_SYSEX_END)
+			continue;
+		
+		if (mctrl->sysex_len >= 0 && mctrl->sysex_len < MIO_SYSEX_LEN)
+			mctrl->sysex[mctrl->sysex_len++] = byte;
+		else
+			mctrl->sysex_len = -1;
+		
+		if (byte == MIO_SYSEX_END) {
+			if (mctrl->sysex_len > 0) {
+				process_dump(mctrl, mctrl->sysex, mctrl->sysex_len);
+				if (mctrl->callbacks.sysex_received)
+					mctrl->callbacks.sysex_received(mctrl, mctrl->sysex, mctrl->sysex_len);
+			} else {
+				LOG(LOG_WARNING, "sysex message too long, dropped");
+			}
+			mctrl->sysex_len = 0;
+			return;
+		}
+	}
+}
+
+/**
+ * Updates the shadow state from a sysex value dump of the controller.
+ * @param mctrl Midi controller
+ * @param data Sysex message
+ * @param len Length of sysex message
+ */
+static void process_dump(mctrl_t *mctrl, const unsigned char *data, int len)
+{
+	int i, header_len = mctrl->dump_header_len;
+	
+	if (header_len == 0 || len < header_len + 2 || memcmp(&data[1], mctrl->dump_header, header_len) != 0)
+		return;
+	
+	for (i = header_len + 1; i + 3 < len; i += 3)
+		mctrl->shadow[data[i] & 0x0f][data[i + 1] & 0x7f] = data[i + 2];
+}
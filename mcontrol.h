@@ -1,7 +1,18 @@
 #ifndef __MCONTROL_H__
 #define __MCONTROL_H__
 
+#include "lat.h"
 #include "mio.h"
+#include "mring.h"
+
+/** maximum number of feedback messages per second sent to a controller */
+#define MCTRL_RATE  500
+
+/** maximum number of feedback messages sent in a single write */
+#define MCTRL_BURST 64
+
+/** maximum length of the sysex dump header (without 0xf0) */
+#define MCTRL_DUMP_HEADER_LEN 8
 
 typedef struct mctrl mctrl_t;
 typedef struct mctrl_cc mctrl_cc_t;
@@ -9,24 +20,45 @@ typedef struct mctrl_callbacks mctrl_callbacks_t;
 
 /** midi controller callbacks */
 struct mctrl_callbacks {
-	void (* cc_changed) (mctrl_t *mctrl, int cc, int value);
+	void (* cc_changed) (mctrl_t *mctrl, int channel, int cc, int value);
+	void (* sysex_received) (mctrl_t *mctrl, const unsigned char *data, int len);
 };
 
 /** midi controller */
 struct mctrl {
 	mio_stream_t input;
 	mio_stream_t output;
+	mring_t ring;                   /**< events read from the input */
+	int subscriber;                 /**< subscriber id of the controller on the ring */
 	mctrl_callbacks_t callbacks;
+	unsigned char shadow[16][128];  /**< values shown by the controller (0xff if unknown) */
+	unsigned char values[16][128];  /**< values to be shown (0xff if never set) */
+	unsigned char queued[16][128];  /**< set if the control is in the dirty list */
+	short dirty[16 * 128];          /**< changed controls (channel * 128 + cc) in order */
+	int num_dirty;
+	mio_timestamp_t last_flush;
+	int credit;                     /**< number of messages that may be sent (1/1000) */
+	unsigned char sysex[MIO_SYSEX_LEN];     /**< incoming sysex message */
+	int sysex_len;                  /**< length of incoming sysex message, -1 if overflown */
+	unsigned char dump_header[MCTRL_DUMP_HEADER_LEN];
+	int dump_header_len;            /**< values are sent as sysex dump if set */
+	unsigned char dump[MIO_SYSEX_LEN];      /**< outgoing sysex dump */
+	int generation;                 /**< output generation the shadow state belongs to */
+	lat_hist_t dispatch_latency;    /**< event read to dispatch */
+	lat_hist_t engine_latency;      /**< event read to change visible to the sequencer */
+	long long event_input;          /**< input time of the event being dispatched in us */
+	long long probe;                /**< set by the sequencer thread once it has seen the changes */
+	long long probe_input;          /**< input time of the oldest unseen change in us, 0 if none */
 };
 
 /**
  * Initializes a midi controller.
  * @param mctrl Midi controller
- * @param input Input device
- * @param output Output device
+ * @param input Input device name
+ * @param output Output device name
  * @return Returns 0 if successful.
  */
-int mctrl_init(mctrl_t *mctrl, mio_device_t *input, mio_device_t *output);
+int mctrl_init(mctrl_t *mctrl, const char *input, const char *output);
 
 /**
  * Shuts a midi controller down.
@@ -44,17 +76,74 @@ mctrl_callbacks_t *mctrl_get_callbacks(mctrl_t *mctrl);
 /**
  * Updates the midi controller by parsing incoming messages.
  * @param mctrl Midi Controller
+ * @return Returns the number of processed messages.
  */
-void mctrl_update(mctrl_t *mctrl);
+int mctrl_update(mctrl_t *mctrl);
 
 /**
- * Sets a cc controller value.
+ * Sets a cc controller value. The value is only queued and sent with the
+ * next flush if it differs from the value shown by the controller.
  * @param mctrl Midi Controller
+ * @param channel Midi channel
  * @param cc Midi cc
  * @param value Value to set
  */
-void mctrl_cc_set(mctrl_t *mctrl, int cc, int value);
+void mctrl_cc_set(mctrl_t *mctrl, int channel, int cc, int value);
 
+/**
+ * Sets the header of sysex value dumps. If set, feedback values are sent as
+ * a single sysex message of the form
+ * 0xf0 <header> (<channel> <cc> <value>)* 0xf7
+ * instead of individual CCs. Incoming dumps of the same form update the
+ * values shown by the controller.
+ * @param mctrl Midi Controller
+ * @param header Header bytes (manufacturer id etc.)
+ * @param len Length of header, 0 to send CCs
+ * @return Returns 0 if successful.
+ */
+int mctrl_set_dump_header(mctrl_t *mctrl, const unsigned char *header, int len);
 
+/**
+ * Sends a complete dump of all controller values, ignoring the values the
+ * controller already shows and the rate limit. Without dump header all
+ * values are sent as CCs in a single write.
+ * @param mctrl Midi Controller
+ * @return Returns 0 if successful.
+ */
+int mctrl_send_dump(mctrl_t *mctrl);
+
+/**
+ * Sends a sysex message to the controller.
+ * @param mctrl Midi Controller
+ * @param data Sysex message, starting with 0xf0 and ending with 0xf7
+ * @param len Length of sysex message
+ * @return Returns 0 if successful.
+ */
+int mctrl_send_sysex(mctrl_t *mctrl, const unsigned char *data, int len);
+
+/**
+ * Sends all changed controller values in a single write. Sending is rate
+ * limited, values which exceed the limit stay queued for the next flush.
+ * @param mctrl Midi Controller
+ * @return Returns the number of values sent.
+ */
+int mctrl_flush(mctrl_t *mctrl);
+
+/**
+ * Returns the time until a flush can send the next queued value.
+ * @param mctrl Midi controller
+ * @return Returns the time in ms, -1 if no values are queued.
+ */
+int mctrl_get_flush_delay(mctrl_t *mctrl);
+
+
+/**
+ * Returns the input latency statistics of a midi controller.
+ * @param mctrl Midi controller
+ * @param dispatch Returns the latency from reading an event to its dispatch
+ * @param engine Returns the latency from reading an event until the resulting
+ * change is visible to the sequencer thread
+ */
+void mctrl_get_latency(mctrl_t *mctrl, lat_stats_t *dispatch, lat_stats_t *engine);
 
 #endif /*__MCONTROL_H__*/
@@ -1,31 +1,125 @@
 
+/* for writer preferring rwlocks */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-#include "portmidi.h"
-#include "porttime.h"
+#include <time.h>
 
 #include "log.h"
 #include "mio.h"
+#include "mio_backend.h"
+
+/** the input thread's waits are sliced, so that a rescan never waits longer (in ms) */
+#define WAIT_SLICE 10
+
+/** number of note offs held back while a rescan is replacing the streams */
+#define PENDING_LEN 256
+
+/** available backends */
+static mio_backend_t *s_backends[] = {
+#ifdef MIO_PORTMIDI
+	&mio_backend_portmidi,
+#endif
+#ifdef MIO_ALSA
+	&mio_backend_alsa,
+#endif
+	&mio_backend_loopback,
+	&mio_backend_null,
+	NULL,
+};
 
-static int s_device_count;
-static mio_device_t *s_devices;
+/** device table, replaced as a whole when a rescan finds changes */
+typedef struct device_table device_table_t;
+struct device_table {
+	int count;
+	mio_device_t *devices;
+	device_table_t *retired;     /**< previous table, freed on shutdown */
+};
 
-static void init_io_devices(void);
+/** note off which could not be written while the streams were locked */
+typedef struct {
+	mio_stream_t *stream;
+	mio_event_t event;
+} pending_t;
+
+static mio_backend_t *s_backend;
+static device_table_t *s_table;
+static mio_stream_t *s_streams[MIO_MAX_STREAMS];
+static pthread_rwlock_t s_lock;
+static pthread_rwlock_t s_wait_lock;
+static pthread_mutex_t s_pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pending_t s_pending[PENDING_LEN];
+static int s_pending_count;
+static int s_pending_lost;
+static pthread_mutex_t s_rescan_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t s_manager_thread;
+static pthread_mutex_t s_manager_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_manager_cond = PTHREAD_COND_INITIALIZER;
+static int s_manager_stop;
+static int s_rescan_requested;
+static int s_rescan_interval;
+static unsigned long s_dropped;
+
+static mio_backend_t *find_backend(const char *name);
+static device_table_t *build_table(void);
+static void free_table(device_table_t *table);
+static int tables_equal(device_table_t *a, device_table_t *b);
+static mio_device_t *find_device(device_table_t *table, const char *name, int output);
+static int register_stream(mio_stream_t *stream, const char *name, int output, int latency);
+static int open_stream(mio_stream_t *stream, mio_device_t *dev);
+static void close_stream(mio_stream_t *stream);
+static void lock_streams(void);
+static void unlock_streams(void);
+static int is_note_off(mio_message_t message);
+static int queue_note_offs(mio_stream_t *stream, mio_event_t *buf, int len);
+static void flush_note_offs(void);
+static void send_all_notes_off(mio_stream_t *stream);
+static void *manager_thread(void *arg);
 
 /*
  * Initializes the midi io subsystem.
  */
-int mio_init(void)
+int mio_init(const char *backend)
 {
-	if (Pm_Initialize() != pmNoError) {
-		LOG(LOG_ERROR, "cannot initialize portmidi");
+	pthread_rwlockattr_t attr;
+	
+	s_backend = find_backend(backend);
+	if (!s_backend) {
+		LOG(LOG_ERROR, "unknown midi backend '%s'", backend);
 		return -1;
 	}
 	
-	Pt_Start(1, NULL, NULL);
+	if (s_backend->init() != 0)
+		return -1;
 	
-	init_io_devices();
+	s_table = build_table();
+	if (!s_table) {
+		LOG(LOG_ERROR, "cannot build midi device table");
+		return -1;
+	}
+	
+	/* a pending rescan must not be starved by the input thread's waits */
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&s_lock, &attr);
+	pthread_rwlock_init(&s_wait_lock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+	
+	s_pending_count = 0;
+	s_pending_lost = 0;
+	
+	/* start device manager */
+	s_manager_stop = 0;
+	s_rescan_requested = 0;
+	s_rescan_interval = 0;
+	if (pthread_create(&s_manager_thread, NULL, manager_thread, NULL)) {
+		LOG(LOG_ERROR, "cannot create device manager thread");
+		return -1;
+	}
 	
 	return 0;
 }
@@ -35,7 +129,19 @@ int mio_init(void)
  */
 void mio_shutdown(void)
 {
-	Pm_Terminate();
+	pthread_mutex_lock(&s_manager_mutex);
+	s_manager_stop = 1;
+	pthread_cond_signal(&s_manager_cond);
+	pthread_mutex_unlock(&s_manager_mutex);
+	pthread_join(s_manager_thread, NULL);
+	
+	s_backend->shutdown();
+	
+	pthread_rwlock_destroy(&s_lock);
+	pthread_rwlock_destroy(&s_wait_lock);
+	
+	free_table(s_table);
+	s_table = NULL;
 }
 
 /*
@@ -43,7 +149,7 @@ void mio_shutdown(void)
  */
 mio_timestamp_t mio_get_timestamp(void)
 {
-	return Pt_Time();
+	return s_backend->get_timestamp();
 }
 
 /*
@@ -51,7 +157,7 @@ mio_timestamp_t mio_get_timestamp(void)
  */
 int mio_get_device_count(void)
 {
-	return s_device_count;
+	return __atomic_load_n(&s_table, __ATOMIC_ACQUIRE)->count;
 }
 
 /*
@@ -59,7 +165,12 @@ int mio_get_device_count(void)
  */
 mio_device_t *mio_get_device(int id)
 {
-	return &s_devices[id];
+	device_table_t *table = __atomic_load_n(&s_table, __ATOMIC_ACQUIRE);
+	
+	if (id < 0 || id >= table->count)
+		return NULL;
+	
+	return &table->devices[id];
 }
 
 /*
@@ -67,13 +178,7 @@ mio_device_t *mio_get_device(int id)
  */
 mio_device_t *mio_get_input_device_by_name(const char *name)
 {
-	int id;
-	
-	for (id = 0; id < s_device_count; id++)
-		if ((strcmp(s_devices[id].name, name) == 0) && (s_devices[id].input > 0))
-			return &s_devices[id];
-	
-	return NULL;
+	return find_device(__atomic_load_n(&s_table, __ATOMIC_ACQUIRE), name, 0);
 }
 
 /*
@@ -81,43 +186,23 @@ mio_device_t *mio_get_input_device_by_name(const char *name)
  */
 mio_device_t *mio_get_output_device_by_name(const char *name)
 {
-	int id;
-	
-	for (id = 0; id < s_device_count; id++)
-		if ((strcmp(s_devices[id].name, name) == 0) && (s_devices[id].output > 0))
-			return &s_devices[id];
-	
-	return NULL;
+	return find_device(__atomic_load_n(&s_table, __ATOMIC_ACQUIRE), name, 1);
 }
 
 /*
  * Opens a midi input stream.
  */
-int mio_open_input(mio_stream_t *stream, mio_device_t *dev)
+int mio_open_input(mio_stream_t *stream, const char *name)
 {
-	stream->dev = dev;
-		
-	if (Pm_OpenInput(&stream->stream, stream->dev->id, NULL, MIO_BUF_LEN, NULL, NULL) != pmNoError) {
-		LOG(LOG_ERROR, "cannot open input stream");
-		return -1;
-	}
-	
-	return 0;
+	return register_stream(stream, name, 0, 0);
 }
 
 /*
  * Opens a midi output stream.
  */
-int mio_open_output(mio_stream_t *stream, mio_device_t *dev, int latency)
+int mio_open_output(mio_stream_t *stream, const char *name, int latency)
 {
-	stream->dev = dev;
-		
-	if (Pm_OpenOutput(&stream->stream, stream->dev->id, NULL, MIO_BUF_LEN, NULL, NULL, latency) != pmNoError) {
-		LOG(LOG_ERROR, "cannot open output stream");
-		return -1;
-	}
-	
-	return 0;
+	return register_stream(stream, name, 1, latency);
 }
 
 /*
@@ -125,7 +210,16 @@ int mio_open_output(mio_stream_t *stream, mio_device_t *dev, int latency)
  */
 void mio_close(mio_stream_t *stream)
 {
-	Pm_Close(stream->stream);
+	int i;
+	
+	lock_streams();
+	
+	close_stream(stream);
+	for (i = 0; i < MIO_MAX_STREAMS; i++)
+		if (s_streams[i] == stream)
+			s_streams[i] = NULL;
+	
+	unlock_streams();
 }
 
 /*
@@ -133,40 +227,599 @@ void mio_close(mio_stream_t *stream)
  */
 int mio_read(mio_stream_t *stream, mio_event_t *buf, int len)
 {
-	return Pm_Read(stream->stream, (PmEvent *) buf, len);
+	int count = 0;
+	
+	/* a rescan is replacing the streams */
+	if (pthread_rwlock_tryrdlock(&s_lock) != 0)
+		return 0;
+	
+	if (stream->handle)
+		count = s_backend->read(stream, buf, len);
+	
+	pthread_rwlock_unlock(&s_lock);
+	
+	return count;
 }
 
 /*
- * Writes to an output stream.
+ * Writes to an output stream. Output is dropped while the device is missing
+ * or a rescan is replacing the streams, so the caller is never blocked. Note
+ * offs are held back and written once the streams are replaced.
  */
 int mio_write(mio_stream_t *stream, mio_event_t *buf, int len)
 {
-	if (Pm_Write(stream->stream, (PmEvent *) buf, len) == pmNoError)
+	int result = 0;
+	
+	if (pthread_rwlock_tryrdlock(&s_lock) != 0)
+		return queue_note_offs(stream, buf, len) > 0 ? MIO_BUSY : 0;
+	
+	if (stream->handle)
+		result = s_backend->write(stream, buf, len);
+	else
+		__atomic_fetch_add(&s_dropped, len, __ATOMIC_RELAXED);
+	
+	pthread_rwlock_unlock(&s_lock);
+	
+	if (result == 0)
 		return 0;
 	LOG(LOG_ERROR, "cannot write to midi output");
 	return -1;
 }
 
+/*
+ * Writes a sysex message to an output stream as a single transfer.
+ */
+int mio_write_sysex(mio_stream_t *stream, const unsigned char *data, int len, mio_timestamp_t timestamp)
+{
+	int result = 0;
+	
+	if (len < 2 || data[0] != MIO_SYSEX_START || data[len - 1] != MIO_SYSEX_END) {
+		LOG(LOG_ERROR, "invalid sysex message");
+		return -1;
+	}
+	
+	if (pthread_rwlock_tryrdlock(&s_lock) != 0) {
+		__atomic_fetch_add(&s_dropped, 1, __ATOMIC_RELAXED);
+		return MIO_BUSY;
+	}
+	
+	/* a sysex message counts as a single event */
+	if (stream->handle)
+		result = s_backend->write_sysex(stream, data, len, timestamp);
+	else
+		__atomic_fetch_add(&s_dropped, 1, __ATOMIC_RELAXED);
+	
+	pthread_rwlock_unlock(&s_lock);
+	
+	if (result == 0)
+		return 0;
+	LOG(LOG_ERROR, "cannot write sysex to midi output");
+	return -1;
+}
+
+/*
+ * Packs a sysex message into events carrying up to 4 bytes each.
+ */
+int mio_pack_sysex(const unsigned char *data, int len, mio_timestamp_t timestamp, mio_event_t *buf, int buf_len)
+{
+	int i, count = 0;
+	
+	for (i = 0; i < len && count < buf_len; i++) {
+		if ((i % 4) == 0) {
+			buf[count].message = 0;
+			buf[count].timestamp = timestamp;
+			count++;
+		}
+		buf[count - 1].message |= (mio_message_t) data[i] << ((i % 4) * 8);
+	}
+	
+	return count;
+}
+
+/*
+ * Waits until at least one of the input streams has events to read.
+ */
+int mio_wait(mio_stream_t **streams, int count, int timeout)
+{
+	struct timespec deadline;
+	int slice, ready = 0;
+	
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	
+	/*
+	 * The wait holds its own lock instead of the stream lock, otherwise a
+	 * queued rescan would make every write fail until the wait times out.
+	 * A rescan takes the wait lock first and gets it after the current slice.
+	 */
+	while (!ready && timeout > 0) {
+		if (pthread_rwlock_timedrdlock(&s_wait_lock, &deadline) != 0)
+			break;
+		slice = timeout < WAIT_SLICE ? timeout : WAIT_SLICE;
+		ready = s_backend->wait(streams, count, slice);
+		pthread_rwlock_unlock(&s_wait_lock);
+		timeout -= slice;
+	}
+	
+	return ready;
+}
+
+/*
+ * Returns the generation of a stream.
+ */
+int mio_get_generation(mio_stream_t *stream)
+{
+	return __atomic_load_n(&stream->generation, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Returns the number of dropped output events.
+ */
+unsigned long mio_get_dropped(void)
+{
+	return __atomic_load_n(&s_dropped, __ATOMIC_RELAXED);
+}
+
+/*
+ * Rescans the midi io devices and reopens streams by name.
+ */
+int mio_rescan(void)
+{
+	device_table_t *table;
+	mio_device_t *dev;
+	mio_stream_t *stream;
+	mio_device_t *was_open[MIO_MAX_STREAMS];
+	int i, changed, locked = 0;
+	int result = -1;
+	
+	pthread_mutex_lock(&s_rescan_mutex);
+	
+	/* the device table a stream was opened from stays valid until shutdown */
+	for (i = 0; i < MIO_MAX_STREAMS; i++)
+		was_open[i] = s_streams[i] && s_streams[i]->handle ? s_streams[i]->dev : NULL;
+	
+	/* some backends can only rescan with all streams closed */
+	if (s_backend->rescan_closes) {
+		lock_streams();
+		locked = 1;
+		for (i = 0; i < MIO_MAX_STREAMS; i++)
+			if (s_streams[i])
+				close_stream(s_streams[i]);
+	}
+	
+	if (s_backend->rescan && s_backend->rescan() != 0) {
+		LOG(LOG_ERROR, "cannot rescan midi devices");
+		goto out;
+	}
+	
+	table = build_table();
+	if (!table) {
+		LOG(LOG_ERROR, "cannot build midi device table");
+		goto out;
+	}
+	
+	changed = !tables_equal(table, s_table);
+	if (!changed && !locked) {
+		free_table(table);
+		result = 0;
+		goto out;
+	}
+	
+	/* the expensive part is done, now swap devices and streams */
+	if (!locked) {
+		lock_streams();
+		locked = 1;
+	}
+	
+	for (i = 0; i < MIO_MAX_STREAMS; i++) {
+		stream = s_streams[i];
+		if (!stream)
+			continue;
+		
+		dev = find_device(table, stream->name, stream->output);
+		if (stream->handle && (!dev || strcmp(stream->dev->interface, dev->interface) != 0))
+			close_stream(stream);
+		
+		if (stream->handle)
+			stream->dev = dev;
+		else if (dev && open_stream(stream, dev) == 0 && stream->output &&
+			(!was_open[i] || strcmp(was_open[i]->interface, dev->interface) != 0))
+			send_all_notes_off(stream);
+		
+		if (was_open[i] && !stream->handle)
+			LOG(LOG_WARNING, "midi %s '%s' has gone, muted until it reappears", stream->output ? "output" : "input", stream->name);
+		else if (!was_open[i] && stream->handle)
+			LOG(LOG_INFO, "midi %s '%s' has appeared", stream->output ? "output" : "input", stream->name);
+	}
+	
+	table->retired = s_table;
+	__atomic_store_n(&s_table, table, __ATOMIC_RELEASE);
+	
+	result = changed;
+	
+out:
+	if (locked)
+		unlock_streams();
+	
+	pthread_mutex_unlock(&s_rescan_mutex);
+	
+	return result;
+}
+
+/*
+ * Asks the device manager thread to rescan the midi io devices.
+ */
+void mio_request_rescan(void)
+{
+	pthread_mutex_lock(&s_manager_mutex);
+	s_rescan_requested = 1;
+	pthread_cond_signal(&s_manager_cond);
+	pthread_mutex_unlock(&s_manager_mutex);
+}
+
+/*
+ * Sets the interval of periodic device rescans.
+ */
+void mio_set_rescan_interval(int interval)
+{
+	/* reinitializing the backend every few seconds would interrupt playback */
+	if (interval > 0 && s_backend->rescan_closes) {
+		LOG(LOG_INFO, "%s backend rescans midi devices on request only", s_backend->name);
+		interval = 0;
+	}
+	
+	pthread_mutex_lock(&s_manager_mutex);
+	s_rescan_interval = interval;
+	pthread_cond_signal(&s_manager_cond);
+	pthread_mutex_unlock(&s_manager_mutex);
+}
+
+/**
+ * Looks up a backend by name.
+ * @param name Backend name
+ * @return Returns the backend or NULL if not available.
+ */
+static mio_backend_t *find_backend(const char *name)
+{
+	int i;
+	
+	for (i = 0; s_backends[i]; i++)
+		if (strcmp(s_backends[i]->name, name) == 0)
+			return s_backends[i];
+	
+	return NULL;
+}
+
+/**
+ * Builds a device table from the backend's current devices. Names are
+ * copied, so the table stays valid when the backend rescans.
+ * @return Returns the device table or NULL on failure.
+ */
+static device_table_t *build_table(void)
+{
+	device_table_t *table;
+	mio_device_t *dev;
+	int id;
+	
+	table = calloc(1, sizeof(device_table_t));
+	if (!table)
+		return NULL;
+	
+	table->count = s_backend->get_device_count();
+	table->devices = calloc(table->count > 0 ? table->count : 1, sizeof(mio_device_t));
+	if (!table->devices) {
+		free(table);
+		return NULL;
+	}
+	
+	for (id = 0; id < table->count; id++) {
+		dev = &table->devices[id];
+		s_backend->get_device(id, dev);
+		dev->name = strdup(dev->name);
+		dev->interface = strdup(dev->interface);
+	}
+	
+	return table;
+}
+
+/**
+ * Frees a device table and all tables it has replaced.
+ * @param table Device table
+ */
+static void free_table(device_table_t *table)
+{
+	device_table_t *retired;
+	int id;
+	
+	while (table) {
+		for (id = 0; id < table->count; id++) {
+			free((char *) table->devices[id].name);
+			free((char *) table->devices[id].interface);
+		}
+		free(table->devices);
+		retired = table->retired;
+		free(table);
+		table = retired;
+	}
+}
+
+/**
+ * Compares two device tables.
+ * @param a Device table
+ * @param b Device table
+ * @return Returns 1 if both tables list the same devices.
+ */
+static int tables_equal(device_table_t *a, device_table_t *b)
+{
+	int id;
+	
+	if (a->count != b->count)
+		return 0;
+	
+	for (id = 0; id < a->count; id++)
+		if (strcmp(a->devices[id].name, b->devices[id].name) != 0 ||
+			strcmp(a->devices[id].interface, b->devices[id].interface) != 0 ||
+			a->devices[id].input != b->devices[id].input ||
+			a->devices[id].output != b->devices[id].output)
+			return 0;
+	
+	return 1;
+}
+
 /**
- * Inits the internal table of midi io devices.
+ * Looks up a device by name.
+ * @param table Device table
+ * @param name Device name
+ * @param output 1 to look for an output, 0 for an input
+ * @return Returns the device or NULL if not found.
  */
-static void init_io_devices(void)
+static mio_device_t *find_device(device_table_t *table, const char *name, int output)
 {
 	int id;
-	const PmDeviceInfo *dev;
-	mio_device_t *mio_dev;
 	
-	s_device_count = Pm_CountDevices();
+	for (id = 0; id < table->count; id++)
+		if (strcmp(table->devices[id].name, name) == 0 &&
+			(output ? table->devices[id].output : table->devices[id].input) > 0)
+			return &table->devices[id];
+	
+	return NULL;
+}
+
+/**
+ * Registers a stream with the device manager and opens it if its device is
+ * present.
+ * @param stream Stream
+ * @param name Device name
+ * @param output 1 for an output stream, 0 for an input stream
+ * @param latency Output latency in ms
+ * @return Returns 0 if successful.
+ */
+static int register_stream(mio_stream_t *stream, const char *name, int output, int latency)
+{
+	mio_device_t *dev;
+	int i, result = -1;
+	
+	snprintf(stream->name, sizeof(stream->name), "%s", name);
+	stream->output = output;
+	stream->latency = latency;
+	stream->generation = 0;
+	stream->dev = NULL;
+	stream->handle = NULL;
+	
+	lock_streams();
+	
+	for (i = 0; i < MIO_MAX_STREAMS && s_streams[i]; i++);
+	if (i == MIO_MAX_STREAMS) {
+		LOG(LOG_ERROR, "too many midi streams");
+		goto out;
+	}
+	
+	dev = find_device(s_table, name, output);
+	if (!dev)
+		LOG(LOG_WARNING, "midi %s '%s' not found, muted until it appears", output ? "output" : "input", name);
+	else if (open_stream(stream, dev) != 0)
+		goto out;
+	
+	s_streams[i] = stream;
+	result = 0;
+	
+out:
+	unlock_streams();
+	
+	return result;
+}
+
+/**
+ * Opens a stream on a device. Must be called with the stream lock held
+ * for writing.
+ * @param stream Stream
+ * @param dev Device
+ * @return Returns 0 if successful.
+ */
+static int open_stream(mio_stream_t *stream, mio_device_t *dev)
+{
+	int result;
+	
+	stream->dev = dev;
+	stream->handle = NULL;
+	
+	if (stream->output)
+		result = s_backend->open_output(stream, stream->latency);
+	else
+		result = s_backend->open_input(stream);
+	
+	if (result != 0) {
+		stream->handle = NULL;
+		LOG(LOG_ERROR, "cannot open %s stream on '%s'", stream->output ? "output" : "input", stream->name);
+		return -1;
+	}
+	
+	__atomic_add_fetch(&stream->generation, 1, __ATOMIC_RELEASE);
+	
+	return 0;
+}
+
+/**
+ * Closes a stream, leaving it registered. Must be called with the stream
+ * lock held for writing.
+ * @param stream Stream
+ */
+static void close_stream(mio_stream_t *stream)
+{
+	if (stream->handle)
+		s_backend->close(stream);
+	stream->handle = NULL;
+}
+
+/**
+ * Locks the streams for writing. The input thread's wait is left first, so
+ * that writers are shut out only while the streams are replaced.
+ */
+static void lock_streams(void)
+{
+	pthread_rwlock_wrlock(&s_wait_lock);
+	pthread_rwlock_wrlock(&s_lock);
+}
+
+/**
+ * Writes the note offs held back meanwhile and unlocks the streams.
+ */
+static void unlock_streams(void)
+{
+	flush_note_offs();
+	pthread_rwlock_unlock(&s_lock);
+	pthread_rwlock_unlock(&s_wait_lock);
+}
+
+/**
+ * Checks if a message is a note off.
+ * @param message Message
+ * @return Returns 1 for note offs and note ons with zero velocity.
+ */
+static int is_note_off(mio_message_t message)
+{
+	return mio_message_cmd(message) == MIO_CMD_NOTE_OFF ||
+		(mio_message_cmd(message) == MIO_CMD_NOTE_ON && mio_message_data2(message) == 0);
+}
+
+/**
+ * Holds back the note offs of output which cannot be written because the
+ * streams are locked, all other events are dropped.
+ * @param stream Stream
+ * @param buf Event buffer
+ * @param len Length of event buffer
+ * @return Returns the number of dropped events.
+ */
+static int queue_note_offs(mio_stream_t *stream, mio_event_t *buf, int len)
+{
+	int i, dropped = 0;
+	
+	pthread_mutex_lock(&s_pending_mutex);
+	for (i = 0; i < len; i++) {
+		if (!is_note_off(buf[i].message)) {
+			dropped++;
+		} else if (s_pending_count < PENDING_LEN) {
+			s_pending[s_pending_count].stream = stream;
+			s_pending[s_pending_count].event = buf[i];
+			s_pending_count++;
+		} else {
+			/* all notes are turned off instead */
+			s_pending_lost = 1;
+			dropped++;
+		}
+	}
+	pthread_mutex_unlock(&s_pending_mutex);
+	
+	__atomic_fetch_add(&s_dropped, dropped, __ATOMIC_RELAXED);
+	
+	return dropped;
+}
+
+/**
+ * Writes the held back note offs to the streams which are open. Must be
+ * called with the stream lock held for writing.
+ */
+static void flush_note_offs(void)
+{
+	int i;
+	
+	pthread_mutex_lock(&s_pending_mutex);
+	
+	for (i = 0; i < s_pending_count; i++)
+		if (s_pending[i].stream->handle)
+			s_backend->write(s_pending[i].stream, &s_pending[i].event, 1);
+	
+	if (s_pending_lost)
+		for (i = 0; i < MIO_MAX_STREAMS; i++)
+			if (s_streams[i] && s_streams[i]->output && s_streams[i]->handle)
+				send_all_notes_off(s_streams[i]);
+	
+	s_pending_count = 0;
+	s_pending_lost = 0;
+	
+	pthread_mutex_unlock(&s_pending_mutex);
+}
+
+/**
+ * Sends all notes off on all channels, for devices which may still be
+ * playing notes whose note offs have not been written. Must be called with
+ * the stream lock held for writing.
+ * @param stream Output stream
+ */
+static void send_all_notes_off(mio_stream_t *stream)
+{
+	mio_event_t buf[16];
+	mio_timestamp_t timestamp = s_backend->get_timestamp();
+	int channel;
+	
+	for (channel = 0; channel < 16; channel++) {
+		buf[channel].message = mio_message(MIO_CMD_CONTROL_CHANGE, channel, 123, 0);
+		buf[channel].timestamp = timestamp;
+	}
+	s_backend->write(stream, buf, 16);
+}
+
+/**
+ * Device manager thread, rescans on request and periodically so that
+ * neither the sequencer nor the input thread ever enumerates devices.
+ */
+static void *manager_thread(void *arg)
+{
+	struct timespec deadline;
+	int interval;
 	
-	s_devices = malloc(sizeof(mio_device_t) * s_device_count);
+	pthread_mutex_lock(&s_manager_mutex);
 	
-	for (id = 0; id < s_device_count; id++) {
-		dev = Pm_GetDeviceInfo(id);
-		mio_dev = &s_devices[id];
-		mio_dev->id = id;
-		mio_dev->name = dev->name;
-		mio_dev->interface = dev->interf;
-		mio_dev->input = dev->input;
-		mio_dev->output = dev->output;
+	while (!s_manager_stop) {
+		if (!s_rescan_requested) {
+			interval = s_rescan_interval;
+			if (interval <= 0) {
+				pthread_cond_wait(&s_manager_cond, &s_manager_mutex);
+				continue;
+			}
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += interval / 1000;
+			deadline.tv_nsec += (interval % 1000) * 1000000;
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+			if (pthread_cond_timedwait(&s_manager_cond, &s_manager_mutex, &deadline) != ETIMEDOUT)
+				continue;
+		}
+		
+		s_rescan_requested = 0;
+		pthread_mutex_unlock(&s_manager_mutex);
+		mio_rescan();
+		pthread_mutex_lock(&s_manager_mutex);
 	}
+	
+	pthread_mutex_unlock(&s_manager_mutex);
+	
+	return NULL;
 }
@@ -1,10 +1,23 @@
 #ifndef __MIO_H__
 #define __MIO_H__
 
-#include "portmidi.h"
-
 #define MIO_BUF_LEN 1024
 
+/** maximum length of a sysex message including start and end bytes */
+#define MIO_SYSEX_LEN 1024
+
+/** default midi io backend */
+#define MIO_DEFAULT_BACKEND "portmidi"
+
+/** maximum length of a configured device name */
+#define MIO_NAME_LEN 128
+
+/** maximum number of open streams */
+#define MIO_MAX_STREAMS 16
+
+/** returned by writes which were dropped because a rescan is replacing the streams */
+#define MIO_BUSY -2
+
 /** midi io device information */
 typedef struct {
 	int id;
@@ -16,8 +29,12 @@ typedef struct {
 
 /** midi input or output stream */
 typedef struct {
-	mio_device_t *dev;
-	PmStream *stream;
+	mio_device_t *dev;           /**< device the stream is open on */
+	void *handle;                /**< backend handle, NULL while the device is missing */
+	char name[MIO_NAME_LEN];     /**< configured device name */
+	int output;                  /**< 1 for output streams */
+	int latency;                 /**< output latency in ms */
+	int generation;              /**< incremented whenever the device is (re)opened */
 } mio_stream_t;
 
 /** timestamp */
@@ -33,6 +50,7 @@ typedef long mio_timestamp_t;
 #define mio_message_channel(msg) ((msg) & 0x0f)
 #define mio_message_data1(msg)   (((msg) >> 8) & 0xff)
 #define mio_message_data2(msg)   (((msg) >> 16) & 0xff)
+#define mio_message_byte(msg, i) (((msg) >> ((i) * 8)) & 0xff)
 
 /* midi commands */
 #define MIO_CMD_NOTE_OFF           0x80
@@ -43,6 +61,10 @@ typedef long mio_timestamp_t;
 #define MIO_CMD_CHANNEL_PRESSURE   0xd0
 #define MIO_CMD_PITCH_WHEEL        0xe0
 
+/* system exclusive */
+#define MIO_SYSEX_START            0xf0
+#define MIO_SYSEX_END              0xf7
+
 /** message */
 typedef long mio_message_t;
 
@@ -54,9 +76,10 @@ typedef struct {
 
 /**
  * Initializes the midi io subsystem.
+ * @param backend Name of the backend to use (portmidi, alsa, loopback, null)
  * @return Returns 0 if succecssful.
  */
-int mio_init(void);
+int mio_init(const char *backend);
 
 /**
  * Shuts the midi io subsystem down.
@@ -78,7 +101,7 @@ int mio_get_device_count(void);
 /**
  * Returns a midi io device.
  * @param id Device id
- * @return Returns the midi io device.
+ * @return Returns the midi io device or NULL if the id is out of range.
  */
 mio_device_t *mio_get_device(int id);
 
@@ -97,21 +120,23 @@ mio_device_t *mio_get_input_device_by_name(const char *name);
 mio_device_t *mio_get_output_device_by_name(const char *name);
 
 /**
- * Opens a midi input stream.
+ * Opens a midi input stream on the device with the given name. If the
+ * device is missing, the stream stays silent until a rescan finds it.
  * @param stream Stream
- * @param dev Device
+ * @param name Device name
  * @return Returns 0 if successful.
  */
-int mio_open_input(mio_stream_t *stream, mio_device_t *dev);
+int mio_open_input(mio_stream_t *stream, const char *name);
 
 /**
- * Opens a midi output stream.
+ * Opens a midi output stream on the device with the given name. If the
+ * device is missing, the stream is muted until a rescan finds it.
  * @param stream Stream
- * @param dev device
- * @param latency Outpu latency in ms
+ * @param name Device name
+ * @param latency Output latency in ms
  * @return Returns 0 if successful.
  */
-int mio_open_output(mio_stream_t *stream, mio_device_t *dev, int latency);
+int mio_open_output(mio_stream_t *stream, const char *name, int latency);
 
 /**
  * Closes a midi stream.
@@ -128,12 +153,82 @@ void mio_close(mio_stream_t *stream);
 int mio_read(mio_stream_t *stream, mio_event_t *buf, int len);
 
 /**
- * Writes to an output stream.
+ * Writes to an output stream. While a rescan is replacing the streams,
+ * note offs are held back and all other events are dropped.
  * @param stream Stream
  * @param buf Event buffer
  * @param len Length of event buffer
- * @return Returns 0 if successful.
+ * @return Returns 0 if successful, MIO_BUSY if events other than note offs
+ * were dropped during a rescan, -1 on error.
  */
 int mio_write(mio_stream_t *stream, mio_event_t *buf, int len);
 
+/**
+ * Writes a sysex message to an output stream as a single transfer.
+ * @param stream Stream
+ * @param data Sysex message, starting with 0xf0 and ending with 0xf7
+ * @param len Length of sysex message
+ * @param timestamp Timestamp
+ * @return Returns 0 if successful, MIO_BUSY if the message was dropped
+ * during a rescan, -1 on error.
+ */
+int mio_write_sysex(mio_stream_t *stream, const unsigned char *data, int len, mio_timestamp_t timestamp);
+
+/**
+ * Packs a sysex message into events carrying up to 4 bytes each, the least
+ * significant byte first. Sysex messages are read from input streams in
+ * this form.
+ * @param data Sysex message
+ * @param len Length of sysex message
+ * @param timestamp Timestamp
+ * @param buf Event buffer
+ * @param buf_len Length of event buffer
+ * @return Returns the number of events.
+ */
+int mio_pack_sysex(const unsigned char *data, int len, mio_timestamp_t timestamp, mio_event_t *buf, int buf_len);
+
+/**
+ * Waits until at least one of the input streams has events to read.
+ * @param streams Input streams
+ * @param count Number of input streams
+ * @param timeout Timeout in ms
+ * @return Returns 1 if events are available, 0 on timeout.
+ */
+int mio_wait(mio_stream_t **streams, int count, int timeout);
+
+/**
+ * Returns the generation of a stream, which changes whenever the stream's
+ * device is reopened after a rescan.
+ * @param stream Stream
+ * @return Returns the generation, 0 if the device was never open.
+ */
+int mio_get_generation(mio_stream_t *stream);
+
+/**
+ * Returns the number of output events dropped because the device was
+ * missing or being rescanned.
+ * @return Returns the number of dropped events since start.
+ */
+unsigned long mio_get_dropped(void);
+
+/**
+ * Rescans the midi io devices. Streams whose device has gone are closed and
+ * muted, streams whose device has (re)appeared are reopened by name and
+ * outputs are sent all notes off. Must not be called from the sequencer
+ * thread.
+ * @return Returns 1 if the device table has changed, 0 if not, -1 on error.
+ */
+int mio_rescan(void);
+
+/**
+ * Asks the device manager thread to rescan the midi io devices.
+ */
+void mio_request_rescan(void);
+
+/**
+ * Sets the interval of periodic device rescans.
+ * @param interval Interval in ms, 0 to rescan on request only
+ */
+void mio_set_rescan_interval(int interval);
+
 #endif /*__MIO_H__*/
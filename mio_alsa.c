@@ -0,0 +1,638 @@
+
+/*
+ * ALSA sequencer midi io backend.
+ *
+ * All output events are scheduled on a kernel side sequencer queue with a
+ * real-time timestamp (event timestamp + stream latency), so the kernel does
+ * the timing and the sequencer thread can render ahead. Input ports are
+ * timestamped by the same queue.
+ *
+ * The backend can be tested without midi hardware by loading the
+ * snd-seq-dummy module (device "Midi Through Port-0") or the snd-virmidi
+ * module (devices "VirMIDI x-y").
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <alsa/asoundlib.h>
+
+#include "log.h"
+#include "mio.h"
+#include "mio_backend.h"
+
+/** maximum number of enumerated devices */
+#define MAX_DEVICES 64
+
+/** maximum number of open input streams */
+#define MAX_INPUTS 8
+
+/** number of events buffered per input stream */
+#define INPUT_BUF_LEN 256
+
+/** remote sequencer port */
+typedef struct {
+	char name[64];
+	char interface[64];
+	int client;
+	int port;
+	int input;
+	int output;
+} alsa_device_t;
+
+/** local port of an open stream */
+typedef struct {
+	int port;                             /**< local port number */
+	int client;                           /**< connected remote client */
+	int remote_port;                      /**< connected remote port */
+	int input;                            /**< 1 for input streams */
+	int latency;                          /**< output latency in ms */
+	mio_event_t events[INPUT_BUF_LEN];    /**< received events */
+	int head;
+	int count;
+	mio_event_t sysex;                    /**< partially packed sysex event */
+	int sysex_bytes;                      /**< number of bytes in sysex event */
+} alsa_port_t;
+
+static snd_seq_t *s_seq;
+static int s_queue;
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static alsa_device_t s_devices[MAX_DEVICES];
+static int s_device_count;
+static alsa_port_t *s_inputs[MAX_INPUTS];
+
+static int alsa_init(void);
+static void alsa_shutdown(void);
+static mio_timestamp_t alsa_get_timestamp(void);
+static int alsa_get_device_count(void);
+static void alsa_get_device(int id, mio_device_t *dev);
+static int alsa_open_input(mio_stream_t *stream);
+static int alsa_open_output(mio_stream_t *stream, int latency);
+static void alsa_close(mio_stream_t *stream);
+static int alsa_read(mio_stream_t *stream, mio_event_t *buf, int len);
+static int alsa_write(mio_stream_t *stream, mio_event_t *buf, int len);
+static int alsa_write_sysex(mio_stream_t *stream, const unsigned char *data, int len, mio_timestamp_t timestamp);
+static int alsa_wait(mio_stream_t **streams, int count, int timeout);
+static int alsa_rescan(void);
+static void scan_devices(void);
+static alsa_port_t *create_port(mio_stream_t *stream, int input);
+static int output_event(alsa_port_t *port, snd_seq_event_t *ev, mio_timestamp_t timestamp);
+static void fetch_input(void);
+static void put_event(alsa_port_t *port, mio_event_t *event);
+static void put_sysex(alsa_port_t *port, snd_seq_event_t *ev);
+static int decode_event(snd_seq_event_t *ev, mio_event_t *event);
+static int encode_event(mio_event_t *event, snd_seq_event_t *ev);
+
+/** alsa sequencer backend */
+mio_backend_t mio_backend_alsa = {
+	.name = "alsa",
+	.init = alsa_init,
+	.shutdown = alsa_shutdown,
+	.get_timestamp = alsa_get_timestamp,
+	.get_device_count = alsa_get_device_count,
+	.get_device = alsa_get_device,
+	.open_input = alsa_open_input,
+	.open_output = alsa_open_output,
+	.close = alsa_close,
+	.read = alsa_read,
+	.write = alsa_write,
+	.write_sysex = alsa_write_sysex,
+	.wait = alsa_wait,
+	.rescan = alsa_rescan,
+};
+
+/**
+ * Opens the sequencer, allocates and starts the queue.
+ */
+static int alsa_init(void)
+{
+	if (snd_seq_open(&s_seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK) < 0) {
+		LOG(LOG_ERROR, "cannot open alsa sequencer");
+		return -1;
+	}
+
+	snd_seq_set_client_name(s_seq, "ssq");
+
+	s_queue = snd_seq_alloc_named_queue(s_seq, "ssq");
+	if (s_queue < 0) {
+		LOG(LOG_ERROR, "cannot allocate alsa sequencer queue");
+		snd_seq_close(s_seq);
+		return -1;
+	}
+
+	snd_seq_start_queue(s_seq, s_queue, NULL);
+	snd_seq_drain_output(s_seq);
+
+	scan_devices();
+
+	return 0;
+}
+
+/**
+ * Stops the queue and closes the sequencer.
+ */
+static void alsa_shutdown(void)
+{
+	snd_seq_stop_queue(s_seq, s_queue, NULL);
+	snd_seq_drain_output(s_seq);
+	snd_seq_free_queue(s_seq, s_queue);
+	snd_seq_close(s_seq);
+}
+
+/**
+ * Returns the real-time of the sequencer queue in milliseconds.
+ */
+static mio_timestamp_t alsa_get_timestamp(void)
+{
+	snd_seq_queue_status_t *status;
+	const snd_seq_real_time_t *time;
+
+	snd_seq_queue_status_alloca(&status);
+	if (snd_seq_get_queue_status(s_seq, s_queue, status) < 0)
+		return 0;
+
+	time = snd_seq_queue_status_get_real_time(status);
+
+	return (mio_timestamp_t) time->tv_sec * 1000 + time->tv_nsec / 1000000;
+}
+
+/**
+ * Returns the number of sequencer ports.
+ */
+static int alsa_get_device_count(void)
+{
+	return s_device_count;
+}
+
+/**
+ * Fills in information of a sequencer port.
+ */
+static void alsa_get_device(int id, mio_device_t *dev)
+{
+	dev->id = id;
+	dev->name = s_devices[id].name;
+	dev->interface = s_devices[id].interface;
+	dev->input = s_devices[id].input;
+	dev->output = s_devices[id].output;
+}
+
+/**
+ * Opens an input stream by connecting a local port from the remote port.
+ */
+static int alsa_open_input(mio_stream_t *stream)
+{
+	alsa_port_t *port;
+	int i;
+
+	port = create_port(stream, 1);
+	if (!port)
+		return -1;
+
+	pthread_mutex_lock(&s_mutex);
+	for (i = 0; i < MAX_INPUTS; i++) {
+		if (!s_inputs[i]) {
+			s_inputs[i] = port;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&s_mutex);
+
+	if (i == MAX_INPUTS) {
+		alsa_close(stream);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Opens an output stream by connecting a local port to the remote port.
+ */
+static int alsa_open_output(mio_stream_t *stream, int latency)
+{
+	alsa_port_t *port;
+
+	port = create_port(stream, 0);
+	if (!port)
+		return -1;
+
+	port->latency = latency;
+
+	return 0;
+}
+
+/**
+ * Closes a stream and deletes its local port.
+ */
+static void alsa_close(mio_stream_t *stream)
+{
+	alsa_port_t *port = stream->handle;
+	int i;
+
+	if (!port)
+		return;
+
+	pthread_mutex_lock(&s_mutex);
+	for (i = 0; i < MAX_INPUTS; i++)
+		if (s_inputs[i] == port)
+			s_inputs[i] = NULL;
+
+	if (port->input)
+		snd_seq_disconnect_from(s_seq, port->port, port->client, port->remote_port);
+	else
+		snd_seq_disconnect_to(s_seq, port->port, port->client, port->remote_port);
+	snd_seq_delete_port(s_seq, port->port);
+	pthread_mutex_unlock(&s_mutex);
+
+	free(port);
+	stream->handle = NULL;
+}
+
+/**
+ * Reads from an input stream.
+ */
+static int alsa_read(mio_stream_t *stream, mio_event_t *buf, int len)
+{
+	alsa_port_t *port = stream->handle;
+	int i;
+
+	pthread_mutex_lock(&s_mutex);
+
+	fetch_input();
+
+	for (i = 0; i < len && port->count > 0; i++) {
+		buf[i] = port->events[port->head];
+		port->head = (port->head + 1) % INPUT_BUF_LEN;
+		port->count--;
+	}
+
+	pthread_mutex_unlock(&s_mutex);
+
+	return i;
+}
+
+/**
+ * Schedules events on the sequencer queue.
+ */
+static int alsa_write(mio_stream_t *stream, mio_event_t *buf, int len)
+{
+	alsa_port_t *port = stream->handle;
+	snd_seq_event_t ev;
+	int i, result = 0;
+
+	pthread_mutex_lock(&s_mutex);
+
+	for (i = 0; i < len; i++) {
+		snd_seq_ev_clear(&ev);
+		if (encode_event(&buf[i], &ev) != 0)
+			continue;
+		if (output_event(port, &ev, buf[i].timestamp) != 0)
+			result = -1;
+	}
+
+	if (snd_seq_drain_output(s_seq) < 0)
+		result = -1;
+
+	pthread_mutex_unlock(&s_mutex);
+
+	return result;
+}
+
+/**
+ * Schedules a sysex message on the sequencer queue.
+ */
+static int alsa_write_sysex(mio_stream_t *stream, const unsigned char *data, int len, mio_timestamp_t timestamp)
+{
+	alsa_port_t *port = stream->handle;
+	snd_seq_event_t ev;
+	int result = 0;
+
+	pthread_mutex_lock(&s_mutex);
+
+	snd_seq_ev_clear(&ev);
+	snd_seq_ev_set_sysex(&ev, len, (void *) data);
+	if (output_event(port, &ev, timestamp) != 0 || snd_seq_drain_output(s_seq) < 0)
+		result = -1;
+
+	pthread_mutex_unlock(&s_mutex);
+
+	return result;
+}
+
+/**
+ * Waits for input by polling the sequencer's file descriptors.
+ */
+static int alsa_wait(mio_stream_t **streams, int count, int timeout)
+{
+	struct pollfd pfds[4];
+	alsa_port_t *port;
+	int nfds, i, ready;
+
+	nfds = snd_seq_poll_descriptors(s_seq, pfds, 4, POLLIN);
+
+	for (;;) {
+		pthread_mutex_lock(&s_mutex);
+		fetch_input();
+		ready = 0;
+		for (i = 0; i < count; i++) {
+			port = streams[i]->handle;
+			if (port && port->count > 0)
+				ready = 1;
+		}
+		pthread_mutex_unlock(&s_mutex);
+
+		if (ready)
+			return 1;
+
+		/* events for other ports may wake us early, the timeout is restarted then */
+		if (poll(pfds, nfds, timeout) <= 0)
+			return 0;
+	}
+}
+
+/**
+ * Rebuilds the device table. Open ports stay connected, ALSA drops the
+ * subscriptions of ports that have gone by itself.
+ */
+static int alsa_rescan(void)
+{
+	pthread_mutex_lock(&s_mutex);
+	scan_devices();
+	pthread_mutex_unlock(&s_mutex);
+
+	return 0;
+}
+
+/**
+ * Builds the device table from all midi ports of other clients.
+ */
+static void scan_devices(void)
+{
+	snd_seq_client_info_t *cinfo;
+	snd_seq_port_info_t *pinfo;
+	alsa_device_t *dev;
+	unsigned int caps;
+	int client;
+
+	snd_seq_client_info_alloca(&cinfo);
+	snd_seq_port_info_alloca(&pinfo);
+
+	s_device_count = 0;
+
+	snd_seq_client_info_set_client(cinfo, -1);
+	while (snd_seq_query_next_client(s_seq, cinfo) >= 0) {
+		client = snd_seq_client_info_get_client(cinfo);
+		if (client == SND_SEQ_CLIENT_SYSTEM || client == snd_seq_client_id(s_seq))
+			continue;
+
+		snd_seq_port_info_set_client(pinfo, client);
+		snd_seq_port_info_set_port(pinfo, -1);
+		while (snd_seq_query_next_port(s_seq, pinfo) >= 0) {
+			if (!(snd_seq_port_info_get_type(pinfo) & SND_SEQ_PORT_TYPE_MIDI_GENERIC))
+				continue;
+			if (s_device_count >= MAX_DEVICES)
+				return;
+
+			caps = snd_seq_port_info_get_capability(pinfo);
+			dev = &s_devices[s_device_count++];
+			snprintf(dev->name, sizeof(dev->name), "%s", snd_seq_port_info_get_name(pinfo));
+			snprintf(dev->interface, sizeof(dev->interface), "alsa %d:%d", client, snd_seq_port_info_get_port(pinfo));
+			dev->client = client;
+			dev->port = snd_seq_port_info_get_port(pinfo);
+			dev->input = (caps & (SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ)) == (SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ);
+			dev->output = (caps & (SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE)) == (SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
+		}
+	}
+}
+
+/**
+ * Creates a local port and connects it to the stream's device.
+ * @param stream Stream
+ * @param input 1 to create an input port, 0 for an output port
+ * @return Returns the port or NULL on failure.
+ */
+static alsa_port_t *create_port(mio_stream_t *stream, int input)
+{
+	snd_seq_port_info_t *pinfo;
+	alsa_device_t *dev = &s_devices[stream->dev->id];
+	alsa_port_t *port;
+	int result;
+
+	port = calloc(1, sizeof(alsa_port_t));
+	if (!port)
+		return NULL;
+
+	snd_seq_port_info_alloca(&pinfo);
+	snd_seq_port_info_set_name(pinfo, dev->name);
+	snd_seq_port_info_set_type(pinfo, SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+	if (input) {
+		snd_seq_port_info_set_capability(pinfo, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
+		/* let the queue timestamp incoming events */
+		snd_seq_port_info_set_timestamping(pinfo, 1);
+		snd_seq_port_info_set_timestamp_real(pinfo, 1);
+		snd_seq_port_info_set_timestamp_queue(pinfo, s_queue);
+	} else {
+		snd_seq_port_info_set_capability(pinfo, SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ);
+	}
+
+	pthread_mutex_lock(&s_mutex);
+	result = snd_seq_create_port(s_seq, pinfo);
+	if (result >= 0) {
+		port->port = snd_seq_port_info_get_port(pinfo);
+		if (input)
+			result = snd_seq_connect_from(s_seq, port->port, dev->client, dev->port);
+		else
+			result = snd_seq_connect_to(s_seq, port->port, dev->client, dev->port);
+		if (result < 0)
+			snd_seq_delete_port(s_seq, port->port);
+	}
+	pthread_mutex_unlock(&s_mutex);
+
+	if (result < 0) {
+		free(port);
+		return NULL;
+	}
+
+	port->client = dev->client;
+	port->remote_port = dev->port;
+	port->input = input;
+	stream->handle = port;
+
+	return port;
+}
+
+/**
+ * Schedules an event on the sequencer queue at timestamp + stream latency.
+ * Must be called with the mutex held.
+ * @param port Output port
+ * @param ev Sequencer event
+ * @param timestamp Timestamp
+ * @return Returns 0 if successful.
+ */
+static int output_event(alsa_port_t *port, snd_seq_event_t *ev, mio_timestamp_t timestamp)
+{
+	snd_seq_real_time_t time;
+
+	snd_seq_ev_set_source(ev, port->port);
+	snd_seq_ev_set_subs(ev);
+
+	timestamp += port->latency;
+	time.tv_sec = timestamp / 1000;
+	time.tv_nsec = (timestamp % 1000) * 1000000;
+	snd_seq_ev_schedule_real(ev, s_queue, 0, &time);
+
+	return snd_seq_event_output(s_seq, ev) < 0 ? -1 : 0;
+}
+
+/**
+ * Fetches all pending sequencer events and distributes them to the input
+ * streams by destination port. Must be called with the mutex held.
+ */
+static void fetch_input(void)
+{
+	snd_seq_event_t *ev;
+	mio_event_t event;
+	alsa_port_t *port;
+	int i;
+
+	while (snd_seq_event_input(s_seq, &ev) >= 0) {
+		for (i = 0; i < MAX_INPUTS; i++) {
+			port = s_inputs[i];
+			if (!port || port->port != ev->dest.port)
+				continue;
+			if (ev->type == SND_SEQ_EVENT_SYSEX)
+				put_sysex(port, ev);
+			else if (decode_event(ev, &event) == 0)
+				put_event(port, &event);
+			break;
+		}
+	}
+}
+
+/**
+ * Puts an event into the input buffer of a port. Events are dropped if the
+ * stream is not read.
+ * @param port Input port
+ * @param event Midi event
+ */
+static void put_event(alsa_port_t *port, mio_event_t *event)
+{
+	if (port->count < INPUT_BUF_LEN) {
+		port->events[(port->head + port->count) % INPUT_BUF_LEN] = *event;
+		port->count++;
+	}
+}
+
+/**
+ * Packs sysex data into events of 4 bytes. The sequencer may split long
+ * messages into several events, so partial events are kept until the next
+ * part arrives.
+ * @param port Input port
+ * @param ev Sequencer sysex event
+ */
+static void put_sysex(alsa_port_t *port, snd_seq_event_t *ev)
+{
+	unsigned char *data = ev->data.ext.ptr;
+	int i;
+
+	for (i = 0; i < ev->data.ext.len; i++) {
+		if (data[i] == MIO_SYSEX_START)
+			port->sysex_bytes = 0;
+		if (port->sysex_bytes == 0) {
+			port->sysex.message = 0;
+			port->sysex.timestamp = (mio_timestamp_t) ev->time.time.tv_sec * 1000 + ev->time.time.tv_nsec / 1000000;
+		}
+		port->sysex.message |= (mio_message_t) data[i] << (port->sysex_bytes * 8);
+		if (++port->sysex_bytes == 4 || data[i] == MIO_SYSEX_END) {
+			put_event(port, &port->sysex);
+			port->sysex_bytes = 0;
+		}
+	}
+}
+
+/**
+ * Converts a sequencer event to a midi event.
+ * @param ev Sequencer event
+ * @param event Midi event
+ * @return Returns 0 if the event could be converted.
+ */
+static int decode_event(snd_seq_event_t *ev, mio_event_t *event)
+{
+	int value;
+
+	switch (ev->type) {
+	case SND_SEQ_EVENT_NOTEON:
+		event->message = mio_message(MIO_CMD_NOTE_ON, ev->data.note.channel, ev->data.note.note, ev->data.note.velocity);
+		break;
+	case SND_SEQ_EVENT_NOTEOFF:
+		event->message = mio_message(MIO_CMD_NOTE_OFF, ev->data.note.channel, ev->data.note.note, ev->data.note.velocity);
+		break;
+	case SND_SEQ_EVENT_KEYPRESS:
+		event->message = mio_message(MIO_CMD_AFTERTOUCH, ev->data.note.channel, ev->data.note.note, ev->data.note.velocity);
+		break;
+	case SND_SEQ_EVENT_CONTROLLER:
+		event->message = mio_message(MIO_CMD_CONTROL_CHANGE, ev->data.control.channel, ev->data.control.param, ev->data.control.value);
+		break;
+	case SND_SEQ_EVENT_PGMCHANGE:
+		event->message = mio_message(MIO_CMD_PROGRAM_CHANGE, ev->data.control.channel, ev->data.control.value, 0);
+		break;
+	case SND_SEQ_EVENT_CHANPRESS:
+		event->message = mio_message(MIO_CMD_CHANNEL_PRESSURE, ev->data.control.channel, ev->data.control.value, 0);
+		break;
+	case SND_SEQ_EVENT_PITCHBEND:
+		value = ev->data.control.value + 8192;
+		event->message = mio_message(MIO_CMD_PITCH_WHEEL, ev->data.control.channel, value & 0x7f, (value >> 7) & 0x7f);
+		break;
+	default:
+		return -1;
+	}
+
+	event->timestamp = (mio_timestamp_t) ev->time.time.tv_sec * 1000 + ev->time.time.tv_nsec / 1000000;
+
+	return 0;
+}
+
+/**
+ * Converts a midi event to a sequencer event.
+ * @param event Midi event
+ * @param ev Sequencer event
+ * @return Returns 0 if the event could be converted.
+ */
+static int encode_event(mio_event_t *event, snd_seq_event_t *ev)
+{
+	int channel = mio_message_channel(event->message);
+	int data1 = mio_message_data1(event->message);
+	int data2 = mio_message_data2(event->message);
+
+	switch (mio_message_cmd(event->message)) {
+	case MIO_CMD_NOTE_ON:
+		snd_seq_ev_set_noteon(ev, channel, data1, data2);
+		break;
+	case MIO_CMD_NOTE_OFF:
+		snd_seq_ev_set_noteoff(ev, channel, data1, data2);
+		break;
+	case MIO_CMD_AFTERTOUCH:
+		snd_seq_ev_set_keypress(ev, channel, data1, data2);
+		break;
+	case MIO_CMD_CONTROL_CHANGE:
+		snd_seq_ev_set_controller(ev, channel, data1, data2);
+		break;
+	case MIO_CMD_PROGRAM_CHANGE:
+		snd_seq_ev_set_pgmchange(ev, channel, data1);
+		break;
+	case MIO_CMD_CHANNEL_PRESSURE:
+		snd_seq_ev_set_chanpress(ev, channel, data1);
+		break;
+	case MIO_CMD_PITCH_WHEEL:
+		snd_seq_ev_set_pitchbend(ev, channel, ((data2 << 7) | data1) - 8192);
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef __MIO_BACKEND_H__
+#define __MIO_BACKEND_H__
+
+#include "mio.h"
+
+typedef struct mio_backend mio_backend_t;
+
+/** midi io backend */
+struct mio_backend {
+	const char *name;                                                    /**< backend name */
+	int (* init) (void);                                                 /**< initializes the backend */
+	void (* shutdown) (void);                                            /**< shuts the backend down */
+	mio_timestamp_t (* get_timestamp) (void);                            /**< returns the current time in ms */
+	int (* get_device_count) (void);                                     /**< returns the number of devices */
+	void (* get_device) (int id, mio_device_t *dev);                     /**< fills in device information */
+	int (* open_input) (mio_stream_t *stream);                           /**< opens stream->dev for input */
+	int (* open_output) (mio_stream_t *stream, int latency);             /**< opens stream->dev for output */
+	void (* close) (mio_stream_t *stream);                               /**< closes a stream */
+	int (* read) (mio_stream_t *stream, mio_event_t *buf, int len);      /**< reads events, returns count */
+	int (* write) (mio_stream_t *stream, mio_event_t *buf, int len);     /**< writes events, returns 0 if successful */
+	int (* write_sysex) (mio_stream_t *stream, const unsigned char *data, int len, mio_timestamp_t timestamp); /**< writes a sysex message */
+	int (* wait) (mio_stream_t **streams, int count, int timeout);       /**< waits for input, returns 1 if readable */
+	int (* rescan) (void);                                               /**< refreshes the device list, returns 0 if successful */
+	int rescan_closes;                                                   /**< set if rescanning invalidates open streams */
+};
+
+/* available backends */
+#ifdef MIO_PORTMIDI
+extern mio_backend_t mio_backend_portmidi;
+#endif
+#ifdef MIO_ALSA
+extern mio_backend_t mio_backend_alsa;
+#endif
+extern mio_backend_t mio_backend_loopback;
+extern mio_backend_t mio_backend_null;
+
+#endif /*__MIO_BACKEND_H__*/
@@ -0,0 +1,414 @@
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "mio.h"
+#include "mio_backend.h"
+#include "mio_loopback.h"
+
+/** event queue */
+typedef struct {
+	mio_event_t events[MIO_LOOPBACK_QUEUE_LEN];
+	int head;
+	int count;
+	pthread_mutex_t mutex;
+} queue_t;
+
+/** loopback device */
+typedef struct {
+	char name[32];
+	int present;                /**< device is plugged in */
+	queue_t input;
+	queue_t output;
+} loopback_t;
+
+static loopback_t s_devices[MIO_LOOPBACK_DEVICES];
+static int s_device_ids[MIO_LOOPBACK_DEVICES];
+static int s_device_count;
+static int s_capture;
+static int s_manual_time;
+static volatile mio_timestamp_t s_time;
+static struct timespec s_start_time;
+static pthread_mutex_t s_input_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_input_cond = PTHREAD_COND_INITIALIZER;
+
+static int loopback_init(void);
+static int null_init(void);
+static void loopback_shutdown(void);
+static mio_timestamp_t loopback_get_timestamp(void);
+static int loopback_get_device_count(void);
+static void loopback_get_device(int id, mio_device_t *dev);
+static void null_get_device(int id, mio_device_t *dev);
+static int loopback_open_input(mio_stream_t *stream);
+static int loopback_open_output(mio_stream_t *stream, int latency);
+static void loopback_close(mio_stream_t *stream);
+static int loopback_read(mio_stream_t *stream, mio_event_t *buf, int len);
+static int loopback_write(mio_stream_t *stream, mio_event_t *buf, int len);
+static int loopback_write_sysex(mio_stream_t *stream, const unsigned char *data, int len, mio_timestamp_t timestamp);
+static int loopback_wait(mio_stream_t **streams, int count, int timeout);
+static int loopback_rescan(void);
+static int is_readable(mio_stream_t **streams, int count);
+static void init_queue(queue_t *queue);
+static int queue_put(queue_t *queue, mio_event_t *buf, int len);
+static int queue_get(queue_t *queue, mio_event_t *buf, int len);
+
+/** loopback backend, output is captured and input can be fed */
+mio_backend_t mio_backend_loopback = {
+	.name = "loopback",
+	.init = loopback_init,
+	.shutdown = loopback_shutdown,
+	.get_timestamp = loopback_get_timestamp,
+	.get_device_count = loopback_get_device_count,
+	.get_device = loopback_get_device,
+	.open_input = loopback_open_input,
+	.open_output = loopback_open_output,
+	.close = loopback_close,
+	.read = loopback_read,
+	.write = loopback_write,
+	.write_sysex = loopback_write_sysex,
+	.wait = loopback_wait,
+	.rescan = loopback_rescan,
+};
+
+/** null backend, output is discarded */
+mio_backend_t mio_backend_null = {
+	.name = "null",
+	.init = null_init,
+	.shutdown = loopback_shutdown,
+	.get_timestamp = loopback_get_timestamp,
+	.get_device_count = loopback_get_device_count,
+	.get_device = null_get_device,
+	.open_input = loopback_open_input,
+	.open_output = loopback_open_output,
+	.close = loopback_close,
+	.read = loopback_read,
+	.write = loopback_write,
+	.write_sysex = loopback_write_sysex,
+	.wait = loopback_wait,
+	.rescan = loopback_rescan,
+};
+
+/*
+ * Feeds events into the input side of a loopback device.
+ */
+int mio_loopback_feed(int id, mio_event_t *buf, int len)
+{
+	int count;
+	
+	if (id < 0 || id >= MIO_LOOPBACK_DEVICES)
+		return 0;
+	
+	count = queue_put(&s_devices[id].input, buf, len);
+	
+	/* wake up waiting readers */
+	pthread_mutex_lock(&s_input_mutex);
+	pthread_cond_broadcast(&s_input_cond);
+	pthread_mutex_unlock(&s_input_mutex);
+	
+	return count;
+}
+
+/*
+ * Fetches events written to the output side of a loopback device.
+ */
+int mio_loopback_capture(int id, mio_event_t *buf, int len)
+{
+	if (id < 0 || id >= MIO_LOOPBACK_DEVICES)
+		return 0;
+	
+	return queue_get(&s_devices[id].output, buf, len);
+}
+
+/*
+ * Plugs a loopback device in or out.
+ */
+void mio_loopback_set_present(int id, int present)
+{
+	if (id < 0 || id >= MIO_LOOPBACK_DEVICES)
+		return;
+	
+	s_devices[id].present = present;
+}
+
+/*
+ * Switches the loopback clock to manual mode and sets its time.
+ */
+void mio_loopback_set_time(mio_timestamp_t time)
+{
+	s_time = time;
+	s_manual_time = 1;
+}
+
+/**
+ * Initializes the loopback backend.
+ */
+static int loopback_init(void)
+{
+	int id;
+	
+	for (id = 0; id < MIO_LOOPBACK_DEVICES; id++) {
+		snprintf(s_devices[id].name, sizeof(s_devices[id].name), "Loopback %d", id + 1);
+		s_devices[id].present = 1;
+		init_queue(&s_devices[id].input);
+		init_queue(&s_devices[id].output);
+	}
+	
+	loopback_rescan();
+	
+	s_capture = 1;
+	s_manual_time = 0;
+	clock_gettime(CLOCK_MONOTONIC, &s_start_time);
+	
+	return 0;
+}
+
+/**
+ * Initializes the null backend.
+ */
+static int null_init(void)
+{
+	loopback_init();
+	s_capture = 0;
+	
+	return 0;
+}
+
+/**
+ * Shuts the loopback backend down.
+ */
+static void loopback_shutdown(void)
+{
+	int id;
+	
+	for (id = 0; id < MIO_LOOPBACK_DEVICES; id++) {
+		pthread_mutex_destroy(&s_devices[id].input.mutex);
+		pthread_mutex_destroy(&s_devices[id].output.mutex);
+	}
+}
+
+/**
+ * Returns the loopback time, either manual or milliseconds since init.
+ */
+static mio_timestamp_t loopback_get_timestamp(void)
+{
+	struct timespec now;
+	
+	if (s_manual_time)
+		return s_time;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (now.tv_sec - s_start_time.tv_sec) * 1000 + (now.tv_nsec - s_start_time.tv_nsec) / 1000000;
+}
+
+/**
+ * Returns the number of loopback devices.
+ */
+static int loopback_get_device_count(void)
+{
+	return s_device_count;
+}
+
+/**
+ * Fills in information of a loopback device.
+ */
+static void loopback_get_device(int id, mio_device_t *dev)
+{
+	id = s_device_ids[id];
+	
+	dev->id = id;
+	dev->name = s_devices[id].name;
+	dev->interface = "loopback";
+	dev->input = 1;
+	dev->output = 1;
+}
+
+/**
+ * Fills in information of a null device.
+ */
+static void null_get_device(int id, mio_device_t *dev)
+{
+	loopback_get_device(id, dev);
+	dev->interface = "null";
+}
+
+/**
+ * Opens a loopback input stream.
+ */
+static int loopback_open_input(mio_stream_t *stream)
+{
+	stream->handle = &s_devices[stream->dev->id];
+	
+	return 0;
+}
+
+/**
+ * Opens a loopback output stream.
+ */
+static int loopback_open_output(mio_stream_t *stream, int latency)
+{
+	stream->handle = &s_devices[stream->dev->id];
+	
+	return 0;
+}
+
+/**
+ * Closes a loopback stream.
+ */
+static void loopback_close(mio_stream_t *stream)
+{
+	stream->handle = NULL;
+}
+
+/**
+ * Reads fed events from a loopback input stream.
+ */
+static int loopback_read(mio_stream_t *stream, mio_event_t *buf, int len)
+{
+	loopback_t *loopback = stream->handle;
+	
+	return queue_get(&loopback->input, buf, len);
+}
+
+/**
+ * Writes to a loopback output stream. Events are captured by the loopback
+ * backend and discarded by the null backend.
+ */
+static int loopback_write(mio_stream_t *stream, mio_event_t *buf, int len)
+{
+	loopback_t *loopback = stream->handle;
+	
+	if (s_capture)
+		queue_put(&loopback->output, buf, len);
+	
+	return 0;
+}
+
+/**
+ * Captures a sysex message in the packed form it would be read from an input.
+ */
+static int loopback_write_sysex(mio_stream_t *stream, const unsigned char *data, int len, mio_timestamp_t timestamp)
+{
+	mio_event_t buf[MIO_SYSEX_LEN / 4];
+	
+	return loopback_write(stream, buf, mio_pack_sysex(data, len, timestamp, buf, MIO_SYSEX_LEN / 4));
+}
+
+/**
+ * Waits until fed events are available on one of the streams.
+ */
+static int loopback_wait(mio_stream_t **streams, int count, int timeout)
+{
+	struct timespec deadline;
+	int ready;
+	
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	
+	pthread_mutex_lock(&s_input_mutex);
+	while (!(ready = is_readable(streams, count)))
+		if (pthread_cond_timedwait(&s_input_cond, &s_input_mutex, &deadline) != 0)
+			break;
+	pthread_mutex_unlock(&s_input_mutex);
+	
+	return ready;
+}
+
+/**
+ * Lists the loopback devices which are plugged in.
+ */
+static int loopback_rescan(void)
+{
+	int id;
+	
+	s_device_count = 0;
+	for (id = 0; id < MIO_LOOPBACK_DEVICES; id++)
+		if (s_devices[id].present)
+			s_device_ids[s_device_count++] = id;
+	
+	return 0;
+}
+
+/**
+ * Returns 1 if one of the streams has fed events.
+ * @param streams Input streams
+ * @param count Number of input streams
+ * @return Returns 1 if events are available.
+ */
+static int is_readable(mio_stream_t **streams, int count)
+{
+	loopback_t *loopback;
+	int i, ready = 0;
+	
+	for (i = 0; i < count && !ready; i++) {
+		loopback = streams[i]->handle;
+		if (!loopback)
+			continue;
+		pthread_mutex_lock(&loopback->input.mutex);
+		ready = loopback->input.count > 0;
+		pthread_mutex_unlock(&loopback->input.mutex);
+	}
+	
+	return ready;
+}
+
+/**
+ * Initializes an event queue.
+ * @param queue Queue
+ */
+static void init_queue(queue_t *queue)
+{
+	queue->head = 0;
+	queue->count = 0;
+	pthread_mutex_init(&queue->mutex, NULL);
+}
+
+/**
+ * Puts events into a queue. Events not fitting into the queue are dropped.
+ * @param queue Queue
+ * @param buf Event buffer
+ * @param len Length of event buffer
+ * @return Returns the number of events queued.
+ */
+static int queue_put(queue_t *queue, mio_event_t *buf, int len)
+{
+	int i;
+	
+	pthread_mutex_lock(&queue->mutex);
+	for (i = 0; i < len && queue->count < MIO_LOOPBACK_QUEUE_LEN; i++) {
+		queue->events[(queue->head + queue->count) % MIO_LOOPBACK_QUEUE_LEN] = buf[i];
+		queue->count++;
+	}
+	pthread_mutex_unlock(&queue->mutex);
+	
+	return i;
+}
+
+/**
+ * Gets events from a queue.
+ * @param queue Queue
+ * @param buf Event buffer
+ * @param len Length of event buffer
+ * @return Returns the number of events fetched.
+ */
+static int queue_get(queue_t *queue, mio_event_t *buf, int len)
+{
+	int i;
+	
+	pthread_mutex_lock(&queue->mutex);
+	for (i = 0; i < len && queue->count > 0; i++) {
+		buf[i] = queue->events[queue->head];
+		queue->head = (queue->head + 1) % MIO_LOOPBACK_QUEUE_LEN;
+		queue->count--;
+	}
+	pthread_mutex_unlock(&queue->mutex);
+	
+	return i;
+}
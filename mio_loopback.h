@@ -0,0 +1,47 @@
+#ifndef __MIO_LOOPBACK_H__
+#define __MIO_LOOPBACK_H__
+
+#include "mio.h"
+
+/** number of loopback devices */
+#define MIO_LOOPBACK_DEVICES 4
+
+/** number of events a loopback queue can hold */
+#define MIO_LOOPBACK_QUEUE_LEN 4096
+
+/**
+ * Feeds events into the input side of a loopback device. The events are
+ * returned unchanged by mio_read() on streams opened on this device.
+ * @param id Device id
+ * @param buf Event buffer
+ * @param len Length of event buffer
+ * @return Returns the number of events queued.
+ */
+int mio_loopback_feed(int id, mio_event_t *buf, int len);
+
+/**
+ * Fetches events written to the output side of a loopback device. Events
+ * keep the timestamps they were written with.
+ * @param id Device id
+ * @param buf Event buffer
+ * @param len Length of event buffer
+ * @return Returns the number of events fetched.
+ */
+int mio_loopback_capture(int id, mio_event_t *buf, int len);
+
+/**
+ * Plugs a loopback device in or out. The change shows up with the next
+ * device rescan.
+ * @param id Device id
+ * @param present 1 to plug the device in, 0 to unplug it
+ */
+void mio_loopback_set_present(int id, int present);
+
+/**
+ * Switches the loopback clock to manual mode and sets its time. Without
+ * calling this function the loopback clock follows the system clock.
+ * @param time Time in milliseconds
+ */
+void mio_loopback_set_time(mio_timestamp_t time);
+
+#endif /*__MIO_LOOPBACK_H__*/
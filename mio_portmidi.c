@@ -0,0 +1,192 @@
+
+#include <unistd.h>
+
+#include "portmidi.h"
+#include "porttime.h"
+
+#include "log.h"
+#include "mio.h"
+#include "mio_backend.h"
+
+static int pm_init(void);
+static void pm_shutdown(void);
+static mio_timestamp_t pm_get_timestamp(void);
+static int pm_get_device_count(void);
+static void pm_get_device(int id, mio_device_t *dev);
+static int pm_open_input(mio_stream_t *stream);
+static int pm_open_output(mio_stream_t *stream, int latency);
+static void pm_close(mio_stream_t *stream);
+static int pm_read(mio_stream_t *stream, mio_event_t *buf, int len);
+static int pm_write(mio_stream_t *stream, mio_event_t *buf, int len);
+static int pm_write_sysex(mio_stream_t *stream, const unsigned char *data, int len, mio_timestamp_t timestamp);
+static int pm_wait(mio_stream_t **streams, int count, int timeout);
+static int pm_rescan(void);
+
+/** portmidi backend */
+mio_backend_t mio_backend_portmidi = {
+	.name = "portmidi",
+	.init = pm_init,
+	.shutdown = pm_shutdown,
+	.get_timestamp = pm_get_timestamp,
+	.get_device_count = pm_get_device_count,
+	.get_device = pm_get_device,
+	.open_input = pm_open_input,
+	.open_output = pm_open_output,
+	.close = pm_close,
+	.read = pm_read,
+	.write = pm_write,
+	.write_sysex = pm_write_sysex,
+	.wait = pm_wait,
+	.rescan = pm_rescan,
+	.rescan_closes = 1,
+};
+
+/**
+ * Initializes portmidi.
+ */
+static int pm_init(void)
+{
+	if (Pm_Initialize() != pmNoError) {
+		LOG(LOG_ERROR, "cannot initialize portmidi");
+		return -1;
+	}
+	
+	Pt_Start(1, NULL, NULL);
+	
+	return 0;
+}
+
+/**
+ * Shuts portmidi down.
+ */
+static void pm_shutdown(void)
+{
+	Pm_Terminate();
+}
+
+/**
+ * Returns the current porttime timestamp.
+ */
+static mio_timestamp_t pm_get_timestamp(void)
+{
+	return Pt_Time();
+}
+
+/**
+ * Returns the number of portmidi devices.
+ */
+static int pm_get_device_count(void)
+{
+	return Pm_CountDevices();
+}
+
+/**
+ * Fills in information of a portmidi device.
+ */
+static void pm_get_device(int id, mio_device_t *dev)
+{
+	const PmDeviceInfo *info;
+	
+	info = Pm_GetDeviceInfo(id);
+	dev->id = id;
+	dev->name = info->name;
+	dev->interface = info->interf;
+	dev->input = info->input;
+	dev->output = info->output;
+}
+
+/**
+ * Opens a portmidi input stream.
+ */
+static int pm_open_input(mio_stream_t *stream)
+{
+	PmStream *pm_stream;
+	
+	if (Pm_OpenInput(&pm_stream, stream->dev->id, NULL, MIO_BUF_LEN, NULL, NULL) != pmNoError)
+		return -1;
+	
+	stream->handle = pm_stream;
+	
+	return 0;
+}
+
+/**
+ * Opens a portmidi output stream.
+ */
+static int pm_open_output(mio_stream_t *stream, int latency)
+{
+	PmStream *pm_stream;
+	
+	if (Pm_OpenOutput(&pm_stream, stream->dev->id, NULL, MIO_BUF_LEN, NULL, NULL, latency) != pmNoError)
+		return -1;
+	
+	stream->handle = pm_stream;
+	
+	return 0;
+}
+
+/**
+ * Closes a portmidi stream.
+ */
+static void pm_close(mio_stream_t *stream)
+{
+	Pm_Close(stream->handle);
+}
+
+/**
+ * Reads from a portmidi input stream.
+ */
+static int pm_read(mio_stream_t *stream, mio_event_t *buf, int len)
+{
+	return Pm_Read(stream->handle, (PmEvent *) buf, len);
+}
+
+/**
+ * Writes to a portmidi output stream.
+ */
+static int pm_write(mio_stream_t *stream, mio_event_t *buf, int len)
+{
+	return Pm_Write(stream->handle, (PmEvent *) buf, len) == pmNoError ? 0 : -1;
+}
+
+/**
+ * Writes a sysex message to a portmidi output stream.
+ */
+static int pm_write_sysex(mio_stream_t *stream, const unsigned char *data, int len, mio_timestamp_t timestamp)
+{
+	return Pm_WriteSysEx(stream->handle, timestamp, (unsigned char *) data) == pmNoError ? 0 : -1;
+}
+
+/**
+ * Waits for input on portmidi streams. Portmidi has no blocking read, so the
+ * streams are polled every millisecond.
+ */
+static int pm_wait(mio_stream_t **streams, int count, int timeout)
+{
+	int i;
+	
+	for (;;) {
+		for (i = 0; i < count; i++)
+			if (streams[i]->handle && Pm_Poll(streams[i]->handle) > 0)
+				return 1;
+		if (timeout-- <= 0)
+			return 0;
+		usleep(1000);
+	}
+}
+
+/**
+ * Rescans portmidi devices. Portmidi enumerates devices only when it is
+ * initialized, so it is reinitialized with all streams closed.
+ */
+static int pm_rescan(void)
+{
+	Pm_Terminate();
+	
+	if (Pm_Initialize() != pmNoError) {
+		LOG(LOG_ERROR, "cannot reinitialize portmidi");
+		return -1;
+	}
+	
+	return 0;
+}
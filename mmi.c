@@ -1,110 +1,96 @@
 
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "log.h"
 #include "config.h"
 #include "core.h"
+#include "ccmap.h"
 #include "mcontrol.h"
 #include "pattern.h"
 #include "line.h"
 #include "seq.h"
+#include "rec.h"
+#include "transpose.h"
 #include "screen.h"
 #include "mmi.h"
 
-#define NUM_GLOBAL_PARAMS     8
+/** time in ms the play button is lit on each beat */
+#define BEAT_BLINK_TIME       10
 
-#define CC_STEP_VALUE_FIRST   1
-#define CC_STEP_VALUE_COUNT   32
+/** timeout in ms for the input thread waiting for controller input */
+#define INPUT_TIMEOUT         100
 
-#define CC_STEP_MODE_FIRST    33
-#define CC_STEP_MODE_COUNT    32
+/** default file the cc map of a surface is saved to after midi learn */
+#define DEFAULT_CC_MAP_FILE   "ccmap%d.xml"
 
-#define CC_LINE_FIRST         65
-#define CC_LINE_COUNT         8
-
-#define CC_SEQUENCE_FIRST     73
-#define CC_SEQUENCE_COUNT     4
-
-#define CC_LINE_PARAM_FIRST   81
-#define CC_LINE_PARAM_COUNT   NUM_LINE_PARAMS
-
-#define CC_GLOBAL_PARAM_FIRST 97
-#define CC_GLOBAL_PARAM_COUNT NUM_GLOBAL_PARAMS
-
-#define CC_BUTTON_F1          77
-#define CC_BUTTON_F2          78
-#define CC_BUTTON_F3          79
-#define CC_BUTTON_F4          80
-#define CC_BUTTON_PLAY        105
-#define CC_BUTTON_STOP        106
-#define CC_BUTTON_PREV        107
-#define CC_BUTTON_NEXT        108
-
-
-/** cc buttons */
-typedef enum {
-	BUTTON_CC_F1,
-	BUTTON_CC_F2,
-	BUTTON_CC_F3,
-	BUTTON_CC_F4,
-	BUTTON_CC_PLAY,
-	BUTTON_CC_STOP,
-	BUTTON_CC_PREV,
-	BUTTON_CC_NEXT,
-	BUTTON_CC_LAST,
-} button_cc_t;
-
-/** cc button table entry */
+/** control surface */
 typedef struct {
-	button_cc_t id;
-	int cc;
-} button_cc_entry_t;
-
-/** cc button table */
-static button_cc_entry_t s_button_cc_table[] = {
-	{ BUTTON_CC_F1, CC_BUTTON_F1 },
-	{ BUTTON_CC_F2, CC_BUTTON_F2 },
-	{ BUTTON_CC_F3, CC_BUTTON_F3 },
-	{ BUTTON_CC_F4, CC_BUTTON_F4 },
-	{ BUTTON_CC_PLAY, CC_BUTTON_PLAY },
-	{ BUTTON_CC_STOP, CC_BUTTON_STOP },
-	{ BUTTON_CC_PREV, CC_BUTTON_PREV },
-	{ BUTTON_CC_NEXT, CC_BUTTON_NEXT },
-};
+	mctrl_t mctrl;
+	ccmap_t ccmap;
+	int learned;           /**< set if the cc map was changed by midi learn */
+} surface_t;
 
 /** global parameters */
 static param_t *s_global_params[NUM_GLOBAL_PARAMS];
 
 
 static config_t *s_config;
-static mctrl_t s_mctrl;
+static surface_t s_surfaces[MAX_SURFACES];
+static int s_num_surfaces;
 static mmi_state_t s_mmi_state;
 static pattern_t *s_pattern;
+static mio_timestamp_t s_beat_blink_time;
+
+static pthread_t s_input_thread;
+static int s_input_thread_stop;
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t s_wakeup_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_wakeup_cond = PTHREAD_COND_INITIALIZER;
+static int s_wakeup;
 
-static void cc_changed(mctrl_t *mctrl, int cc, int value);
+static void cc_changed(mctrl_t *mctrl, int channel, int cc, int value);
 static void step_value_changed(int step, int value);
 static void step_mode_changed(int step);
 static void line_changed(int line);
 static void sequence_changed(int sequence);
 static void line_param_changed(int index, int value);
 static void global_param_changed(int index, int value);
-static void button_cc_changed(button_cc_entry_t *entry, int value);
+static void button_cc_changed(button_cc_t button, int value);
 static void button_cc_pressed(button_cc_t button);
 static void show_selected_line(int index);
 static void show_selected_sequence(int index);
 static void show_line_steps(line_t *line);
 static void show_line_params(line_t *line);
 static void show_global_params(void);
+static void show_control(ccmap_action_t action, int arg, int value);
+static void learn_control(int surface, int channel, int cc);
+static void toggle_learn(void);
+static void stop_learn(void);
+static int parse_hex(const char *str, unsigned char *buf, int len);
 static void handle_beat_blink(void);
+static int get_update_timeout(void);
 static void line_mode_changed(line_t *line);
 static void first_last_changed(line_t *line);
+static void *input_thread(void *data);
+static void wakeup(void);
+static void wait_for_wakeup(int timeout);
 
 /*
  * Initializes the mmi.
  */
 int mmi_init(void)
 {
+	surface_config_t *surface_config;
+	surface_t *surface;
+	unsigned char header[MCTRL_DUMP_HEADER_LEN];
+	int i, len;
+	
 	s_config = core_get_config();
 	s_pattern = seq_get_pattern();
 	
@@ -112,20 +98,47 @@ int mmi_init(void)
 	if (scr_init() != 0)
 		return -1;
 	
-	/* init controller */
-	if (mctrl_init(&s_mctrl, mio_get_input_device_by_name(s_config->control_input), 
-		mio_get_output_device_by_name(s_config->control_output)) != 0)
-		return -1;
+	/* init control surfaces */
+	for (i = 0; i < s_config->num_surfaces; i++) {
+		surface_config = &s_config->surfaces[i];
+		surface = &s_surfaces[i];
 		
-	/* set callbacks */
-	mctrl_get_callbacks(&s_mctrl)->cc_changed = cc_changed;
+		if (mctrl_init(&surface->mctrl, surface_config->input, surface_config->output) != 0)
+			return -1;
+		s_num_surfaces++;
+		
+		/* load cc map */
+		ccmap_default(&surface->ccmap);
+		if (surface_config->cc_map[0] && ccmap_load(&surface->ccmap, surface_config->cc_map) != 0)
+			LOG(LOG_WARNING, "using default cc map for surface %d", i + 1);
+		surface->learned = 0;
+		
+		/* send feedback as sysex dumps if configured */
+		if (surface_config->sysex_header[0]) {
+			len = parse_hex(surface_config->sysex_header, header, sizeof(header));
+			if (len < 0 || mctrl_set_dump_header(&surface->mctrl, header, len) != 0)
+				LOG(LOG_WARNING, "invalid sysex header for surface %d", i + 1);
+		}
+		
+		/* set callbacks */
+		mctrl_get_callbacks(&surface->mctrl)->cc_changed = cc_changed;
+	}
 	
 	/* set global params */
 	s_global_params[7] = &s_pattern->tempo;
 	
-	/* show initial state */
+	/* show initial state, sending all values in one transfer */
 	sequence_changed(0);
 	show_global_params();
+	for (i = 0; i < s_num_surfaces; i++)
+		mctrl_send_dump(&s_surfaces[i].mctrl);
+	
+	/* start input thread */
+	s_input_thread_stop = 0;
+	if (pthread_create(&s_input_thread, NULL, input_thread, NULL)) {
+		LOG(LOG_ERROR, "cannot create input thread");
+		return -1;
+	}
 	
 	return 0;
 }
@@ -135,9 +148,16 @@ int mmi_init(void)
  */
 void mmi_shutdown(void)
 {
+	int i;
+	
+	s_input_thread_stop = 1;
+	pthread_join(s_input_thread, NULL);
+	
 	scr_shutdown();
 	
-	mctrl_shutdown(&s_mctrl);
+	for (i = 0; i < s_num_surfaces; i++)
+		mctrl_shutdown(&s_surfaces[i].mctrl);
+	s_num_surfaces = 0;
 }
 
 /*
@@ -145,13 +165,24 @@ void mmi_shutdown(void)
  */
 void mmi_update(void)
 {
-	s_mmi_state.last_edited_step = -1;
+	int i, timeout;
+	
+	pthread_mutex_lock(&s_mutex);
+	timeout = get_update_timeout();
+	pthread_mutex_unlock(&s_mutex);
 	
-	mctrl_update(&s_mctrl);
+	wait_for_wakeup(timeout);
 	
-	scr_update();
+	pthread_mutex_lock(&s_mutex);
 	
 	handle_beat_blink();
+	
+	for (i = 0; i < s_num_surfaces; i++)
+		mctrl_flush(&s_surfaces[i].mctrl);
+	
+	s_mmi_state.last_edited_step = -1;
+	
+	pthread_mutex_unlock(&s_mutex);
 }
 
 /*
@@ -159,62 +190,110 @@ void mmi_update(void)
  */
 void mmi_pulse(int pulse, mio_timestamp_t timestamp)
 {
-	if ((pulse % 24) == 0)
-		s_mmi_state.beat_blink = 1;
-		
-	scr_dirty();
+	/* the screen follows the playback by itself, see scr_init() */
+	if ((pulse % 24) == 0) {
+		__atomic_store_n(&s_mmi_state.beat_blink, 1, __ATOMIC_RELEASE);
+		wakeup();
+	}
+}
+
+/*
+ * Wakes up mmi_update().
+ */
+void mmi_wakeup(void)
+{
+	wakeup();
+}
+
+/*
+ * Returns a copy of the mmi state.
+ */
+void mmi_copy_state(mmi_state_t *state)
+{
+	pthread_mutex_lock(&s_mutex);
+	memcpy(state, &s_mmi_state, sizeof(mmi_state_t));
+	pthread_mutex_unlock(&s_mutex);
 }
 
 /*
- * Returns the mmi state.
+ * Toggles the midi learn mode.
  */
-mmi_state_t *mmi_get_state(void)
+void mmi_learn(void)
 {
-	return &s_mmi_state;
+	pthread_mutex_lock(&s_mutex);
+	toggle_learn();
+	pthread_mutex_unlock(&s_mutex);
+	
+	/* the learn button feedback is flushed by the ui thread */
+	wakeup();
+}
+
+/*
+ * Logs the input latency statistics of all control surfaces.
+ */
+void mmi_log_latency(void)
+{
+	lat_stats_t dispatch, engine;
+	int i;
+	
+	pthread_mutex_lock(&s_mutex);
+	for (i = 0; i < s_num_surfaces; i++) {
+		mctrl_get_latency(&s_surfaces[i].mctrl, &dispatch, &engine);
+		LOG(LOG_INFO, "surface %d input latency (us): dispatch p50 %ld p99 %ld max %ld (%u events), "
+			"engine p50 %ld p99 %ld max %ld (%u changes)", i + 1,
+			dispatch.p50, dispatch.p99, dispatch.max, dispatch.count,
+			engine.p50, engine.p99, engine.max, engine.count);
+	}
+	pthread_mutex_unlock(&s_mutex);
 }
 
 /**
- * Callback called when a registered cc control changed.
+ * Callback called when a cc control changed.
  * @param mctrl Midi controller
+ * @param channel Midi channel
  * @param cc Midi cc
+ * @param value Value
  */
-static void cc_changed(mctrl_t *mctrl, int cc, int value)
+static void cc_changed(mctrl_t *mctrl, int channel, int cc, int value)
 {
-	button_cc_entry_t *button_cc;
-	int i;
+	ccmap_entry_t *entry;
+	int surface;
 	
-	if (cc >= CC_STEP_VALUE_FIRST && cc < CC_STEP_VALUE_FIRST + CC_STEP_VALUE_COUNT)
-		step_value_changed(cc - CC_STEP_VALUE_FIRST, value);
-	else if (cc >= CC_STEP_MODE_FIRST && cc < CC_STEP_MODE_FIRST + CC_STEP_MODE_COUNT)
-		step_mode_changed(cc - CC_STEP_MODE_FIRST);
-	else if (cc >= CC_LINE_FIRST && cc < CC_LINE_FIRST + CC_LINE_COUNT)
-		line_changed(cc - CC_LINE_FIRST);
-	else if (cc >= CC_SEQUENCE_FIRST && cc < CC_SEQUENCE_FIRST + CC_SEQUENCE_COUNT)
-		sequence_changed(cc - CC_SEQUENCE_FIRST);
-	else if (cc >= CC_LINE_PARAM_FIRST && cc < CC_LINE_PARAM_FIRST + CC_LINE_PARAM_COUNT)
-		line_param_changed(cc - CC_LINE_PARAM_FIRST, value);
-	else if (cc >= CC_GLOBAL_PARAM_FIRST && cc < CC_GLOBAL_PARAM_FIRST + CC_GLOBAL_PARAM_COUNT)
-		global_param_changed(cc - CC_GLOBAL_PARAM_FIRST, value);
-	else {
-		/* check buttons */
-		for (i = 0; i < BUTTON_CC_LAST; i++) {
-			button_cc = &s_button_cc_table[i];
-			if (button_cc->cc == cc) {
-				button_cc_changed(button_cc, value);
-				return;
-			}
-		}
-#if 0		
-		/* check params */
-		for (i = 0; i < PARAM_CC_LAST; i++) {
-			param_cc = &s_param_cc_table[i];
-			if (param_cc->cc == cc) {
-				param_cc_changed(param_cc, value);
-				return;
-			}
-		}
-#endif
-	}	
+	for (surface = 0; surface < s_num_surfaces; surface++)
+		if (&s_surfaces[surface].mctrl == mctrl)
+			break;
+	assert(surface < s_num_surfaces);
+	
+	entry = ccmap_get(&s_surfaces[surface].ccmap, channel, cc);
+	
+	if (s_mmi_state.learn && !(entry->action == CCMAP_BUTTON && entry->arg == BUTTON_CC_F4)) {
+		learn_control(surface, channel, cc);
+		return;
+	}
+	
+	switch (entry->action) {
+	case CCMAP_STEP_VALUE:
+		step_value_changed(entry->arg, value);
+		break;
+	case CCMAP_STEP_MODE:
+		step_mode_changed(entry->arg);
+		break;
+	case CCMAP_LINE:
+		line_changed(entry->arg);
+		break;
+	case CCMAP_SEQUENCE:
+		sequence_changed(entry->arg);
+		break;
+	case CCMAP_LINE_PARAM:
+		line_param_changed(entry->arg, value);
+		break;
+	case CCMAP_GLOBAL_PARAM:
+		global_param_changed(entry->arg, value);
+		break;
+	case CCMAP_BUTTON:
+		button_cc_changed(entry->arg, value);
+		break;
+	}
 }
 
 /**
@@ -247,6 +326,7 @@ static void line_changed(int line)
 	s_mmi_state.line = &s_mmi_state.sequence->lines[line];
 	s_mmi_state.line->line_mode_changed = line_mode_changed;
 	s_mmi_state.line->first_last_changed = first_last_changed;
+	rec_set_line(s_mmi_state.line);
 	show_selected_line(line);
 	show_line_steps(s_mmi_state.line);
 	show_line_params(s_mmi_state.line);
@@ -283,11 +363,11 @@ static void global_param_changed(int index, int value)
 	scr_dirty();
 }
 
-static void button_cc_changed(button_cc_entry_t *entry, int value)
+static void button_cc_changed(button_cc_t button, int value)
 {
-	mctrl_cc_set(&s_mctrl, entry->cc, 0);
+	show_control(CCMAP_BUTTON, button, 0);
 	if (value == 127)
-		button_cc_pressed(entry->id);
+		button_cc_pressed(button);
 }
 
 static void button_cc_pressed(button_cc_t button)
@@ -305,9 +385,14 @@ static void button_cc_pressed(button_cc_t button)
 		break;
 	case BUTTON_CC_F3:
 		LOG(LOG_INFO, "F3");
+		/* cycles through the record modes */
+		rec_set_mode((rec_get_mode() + 1) % REC_MODE_LAST);
+		show_control(CCMAP_BUTTON, BUTTON_CC_F3, rec_get_mode() != REC_OFF ? 127 : 0);
+		scr_dirty();
 		break;
 	case BUTTON_CC_F4:
 		LOG(LOG_INFO, "F4");
+		toggle_learn();
 		break;
 	case BUTTON_CC_PLAY:
 		LOG(LOG_INFO, "PLAY");
@@ -315,7 +400,11 @@ static void button_cc_pressed(button_cc_t button)
 		break;
 	case BUTTON_CC_STOP:
 		LOG(LOG_INFO, "STOP");
-		seq_stop();
+		/* pressing stop while stopped sends a panic */
+		if (seq_get_run_state() == SEQ_STOPPED)
+			seq_panic();
+		else
+			seq_stop();
 		break;
 	case BUTTON_CC_PREV:
 		LOG(LOG_INFO, "PREV");
@@ -337,8 +426,8 @@ static void show_selected_line(int index)
 {
 	int i;
 
-	for (i = 0; i < CC_LINE_COUNT; i++)
-		mctrl_cc_set(&s_mctrl, CC_LINE_FIRST + i, i == index ? 127 : 0);
+	for (i = 0; i < NUM_LINES; i++)
+		show_control(CCMAP_LINE, i, i == index ? 127 : 0);
 }
 
 /**
@@ -348,8 +437,8 @@ static void show_selected_sequence(int index)
 {
 	int i;
 
-	for (i = 0; i < CC_SEQUENCE_COUNT; i++)
-		mctrl_cc_set(&s_mctrl, CC_SEQUENCE_FIRST + i, i == index ? 127 : 0);
+	for (i = 0; i < NUM_SEQUENCES; i++)
+		show_control(CCMAP_SEQUENCE, i, i == index ? 127 : 0);
 }
 
 
@@ -358,7 +447,7 @@ static void show_line_steps(line_t *line)
 	int i;
 	
 	for (i = 0; i < NUM_STEPS; i++)
-		mctrl_cc_set(&s_mctrl, CC_STEP_VALUE_FIRST + i, param_get_cc(&line->step_values[i]));
+		show_control(CCMAP_STEP_VALUE, i, param_get_cc(&line->step_values[i]));
 	
 }
 
@@ -371,7 +460,7 @@ static void show_line_params(line_t *line)
 		param = line->params[i];
 		if (!param)
 			continue;
-		mctrl_cc_set(&s_mctrl, CC_LINE_PARAM_FIRST + i, param_get_cc(param));
+		show_control(CCMAP_LINE_PARAM, i, param_get_cc(param));
 	}
 }
 
@@ -384,24 +473,183 @@ static void show_global_params(void)
 		param = s_global_params[i];
 		if (!param)
 			continue;
-		mctrl_cc_set(&s_mctrl, CC_GLOBAL_PARAM_FIRST + i, param_get_cc(param));
+		show_control(CCMAP_GLOBAL_PARAM, i, param_get_cc(param));
 	}
 }
 
-static void handle_beat_blink(void)
+/**
+ * Sends a value to the controller mapped to an action on every surface.
+ * @param action Action
+ * @param arg Argument
+ * @param value Value
+ */
+static void show_control(ccmap_action_t action, int arg, int value)
+{
+	surface_t *surface;
+	int channel, cc, i;
+	
+	for (i = 0; i < s_num_surfaces; i++) {
+		surface = &s_surfaces[i];
+		if (ccmap_find(&surface->ccmap, action, arg, &channel, &cc) == 0)
+			mctrl_cc_set(&surface->mctrl, channel, cc, value);
+	}
+}
+
+/**
+ * Maps a controller to the current learn target and advances to the next
+ * target. Repeated messages of the last learned controller are ignored.
+ * @param surface Surface index
+ * @param channel Midi channel
+ * @param cc Midi cc
+ */
+static void learn_control(int surface, int channel, int cc)
 {
-	if (s_mmi_state.beat_blink > 0) {
-		if (s_mmi_state.beat_blink == 1) {
-			mctrl_cc_set(&s_mctrl, CC_BUTTON_PLAY, 127);
-		} else if (s_mmi_state.beat_blink > 10) {
-			mctrl_cc_set(&s_mctrl, CC_BUTTON_PLAY, 0);
-			s_mmi_state.beat_blink = 0;
+	int control = (surface * 16 + channel) * 128 + cc;
+	
+	if (control == s_mmi_state.learn_control)
+		return;
+	
+	LOG(LOG_INFO, "learned %s %d on surface %d channel %d cc %d", ccmap_get_action_name(s_mmi_state.learn_action),
+		s_mmi_state.learn_arg + 1, surface + 1, channel + 1, cc);
+	
+	ccmap_set(&s_surfaces[surface].ccmap, channel, cc, s_mmi_state.learn_action, s_mmi_state.learn_arg);
+	s_surfaces[surface].learned = 1;
+	s_mmi_state.learn_control = control;
+	
+	if (++s_mmi_state.learn_arg >= ccmap_get_arg_count(s_mmi_state.learn_action)) {
+		s_mmi_state.learn_arg = 0;
+		if (++s_mmi_state.learn_action >= CCMAP_LAST) {
+			stop_learn();
 			return;
 		}
-		s_mmi_state.beat_blink++;
+	}
+	
+	scr_dirty();
+}
+
+/**
+ * Toggles the midi learn mode.
+ */
+static void toggle_learn(void)
+{
+	if (s_mmi_state.learn) {
+		stop_learn();
+		return;
+	}
+	
+	s_mmi_state.learn = 1;
+	s_mmi_state.learn_action = CCMAP_NONE + 1;
+	s_mmi_state.learn_arg = 0;
+	s_mmi_state.learn_control = -1;
+	show_control(CCMAP_BUTTON, BUTTON_CC_F4, 127);
+	LOG(LOG_INFO, "midi learn started");
+	scr_dirty();
+}
+
+/**
+ * Stops the midi learn mode and saves the cc map.
+ */
+static void stop_learn(void)
+{
+	char filename[128];
+	int i;
+	
+	s_mmi_state.learn = 0;
+	LOG(LOG_INFO, "midi learn stopped");
+	
+	/* save the cc maps of all surfaces changed */
+	for (i = 0; i < s_num_surfaces; i++) {
+		if (!s_surfaces[i].learned)
+			continue;
+		if (s_config->surfaces[i].cc_map[0])
+			snprintf(filename, sizeof(filename), "%s", s_config->surfaces[i].cc_map);
+		else
+			snprintf(filename, sizeof(filename), DEFAULT_CC_MAP_FILE, i + 1);
+		LOG(LOG_INFO, "saving cc map of surface %d to '%s'", i + 1, filename);
+		ccmap_save(&s_surfaces[i].ccmap, filename);
+		s_surfaces[i].learned = 0;
+	}
+	
+	/* show the current state with the new mapping */
+	show_selected_sequence(s_mmi_state.sequence_index);
+	show_selected_line(s_mmi_state.line_index);
+	show_line_steps(s_mmi_state.line);
+	show_line_params(s_mmi_state.line);
+	show_global_params();
+	show_control(CCMAP_BUTTON, BUTTON_CC_F4, 0);
+	scr_dirty();
+}
+
+/**
+ * Parses a string of hex bytes separated by spaces.
+ * @param str String
+ * @param buf Byte buffer
+ * @param len Length of byte buffer
+ * @return Returns the number of bytes or -1 if invalid.
+ */
+static int parse_hex(const char *str, unsigned char *buf, int len)
+{
+	char *end;
+	long value;
+	int count = 0;
+	
+	for (;;) {
+		while (*str == ' ')
+			str++;
+		if (!*str)
+			return count;
+		value = strtol(str, &end, 16);
+		if (end == str || value < 0 || value > 0x7f || count >= len)
+			return -1;
+		buf[count++] = value;
+		str = end;
+	}
+}
+
+static void handle_beat_blink(void)
+{
+	int beat_blink = __atomic_load_n(&s_mmi_state.beat_blink, __ATOMIC_ACQUIRE);
+	
+	if (beat_blink == 1) {
+		show_control(CCMAP_BUTTON, BUTTON_CC_PLAY, 127);
+		s_beat_blink_time = mio_get_timestamp();
+		__atomic_store_n(&s_mmi_state.beat_blink, 2, __ATOMIC_RELAXED);
+	} else if (beat_blink > 1) {
+		/* the sequencer thread may have started the next blink meanwhile */
+		if (mio_get_timestamp() - s_beat_blink_time >= BEAT_BLINK_TIME &&
+			__atomic_compare_exchange_n(&s_mmi_state.beat_blink, &beat_blink, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			show_control(CCMAP_BUTTON, BUTTON_CC_PLAY, 0);
 	}
 }
 
+/**
+ * Returns how long the ui thread may wait for a wakeup until pending work is
+ * due, which is turning off the play button or flushing values the rate limit
+ * held back.
+ * @return Returns the timeout in ms, -1 if nothing is pending.
+ */
+static int get_update_timeout(void)
+{
+	int beat_blink = __atomic_load_n(&s_mmi_state.beat_blink, __ATOMIC_ACQUIRE);
+	int timeout = -1, delay, i;
+	
+	if (beat_blink == 1)
+		return 0;
+	if (beat_blink > 1) {
+		timeout = BEAT_BLINK_TIME - (mio_get_timestamp() - s_beat_blink_time);
+		if (timeout < 0)
+			timeout = 0;
+	}
+	
+	for (i = 0; i < s_num_surfaces; i++) {
+		delay = mctrl_get_flush_delay(&s_surfaces[i].mctrl);
+		if (delay >= 0 && (timeout < 0 || delay < timeout))
+			timeout = delay;
+	}
+	
+	return timeout;
+}
+
 /**
  * Gets called when a line has changed it's mode.
  */
@@ -422,3 +670,96 @@ static void first_last_changed(line_t *line)
 
 	show_line_params(s_mmi_state.line);
 }
+
+/**
+ * Input thread. Blocks until controller or sequencer input is available and
+ * dispatches it immediately. The ui thread is only woken up if events were
+ * processed.
+ * @param data User data
+ * @return Return code.
+ */
+static void *input_thread(void *data)
+{
+	mio_stream_t *inputs[MAX_SURFACES + 1];
+	mring_t *seq_ring = core_get_input_ring();
+	const mio_event_t *events;
+	int transpose_subscriber, rec_subscriber;
+	int count, i, n;
+	
+	/* wait on all control surfaces and the sequencer input at once */
+	for (i = 0; i < s_num_surfaces; i++)
+		inputs[i] = &s_surfaces[i].mctrl.input;
+	inputs[s_num_surfaces] = seq_ring->stream;
+	
+	/* sequencer input is shared by the keyboard transpose and the recorder */
+	transpose_subscriber = mring_subscribe(seq_ring);
+	rec_subscriber = mring_subscribe(seq_ring);
+	
+	while (!s_input_thread_stop) {
+		if (!mio_wait(inputs, s_num_surfaces + 1, INPUT_TIMEOUT))
+			continue;
+		
+		pthread_mutex_lock(&s_mutex);
+		count = 0;
+		for (i = 0; i < s_num_surfaces; i++)
+			count += mctrl_update(&s_surfaces[i].mctrl);
+		count += mring_fill(seq_ring);
+		while ((n = mring_peek(seq_ring, transpose_subscriber, &events)) > 0) {
+			transpose_process(events, n);
+			mring_consume(seq_ring, transpose_subscriber, n);
+		}
+		while ((n = mring_peek(seq_ring, rec_subscriber, &events)) > 0) {
+			rec_process(events, n);
+			mring_consume(seq_ring, rec_subscriber, n);
+		}
+		for (i = 0; i < s_num_surfaces; i++)
+			mctrl_flush(&s_surfaces[i].mctrl);
+		pthread_mutex_unlock(&s_mutex);
+		
+		if (count > 0)
+			wakeup();
+	}
+	
+	pthread_exit(NULL);
+}
+
+/**
+ * Wakes up the ui thread.
+ */
+static void wakeup(void)
+{
+	pthread_mutex_lock(&s_wakeup_mutex);
+	s_wakeup = 1;
+	pthread_cond_signal(&s_wakeup_cond);
+	pthread_mutex_unlock(&s_wakeup_mutex);
+}
+
+/**
+ * Waits until the ui thread is woken up or the timeout expired.
+ * @param timeout Timeout in ms, -1 to wait without timeout
+ */
+static void wait_for_wakeup(int timeout)
+{
+	struct timespec deadline;
+	
+	if (timeout < 0) {
+		pthread_mutex_lock(&s_wakeup_mutex);
+		while (!s_wakeup)
+			pthread_cond_wait(&s_wakeup_cond, &s_wakeup_mutex);
+		s_wakeup = 0;
+		pthread_mutex_unlock(&s_wakeup_mutex);
+		return;
+	}
+	
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += timeout * 1000000L;
+	deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+	deadline.tv_nsec %= 1000000000L;
+	
+	pthread_mutex_lock(&s_wakeup_mutex);
+	while (!s_wakeup)
+		if (pthread_cond_timedwait(&s_wakeup_cond, &s_wakeup_mutex, &deadline) == ETIMEDOUT)
+			break;
+	s_wakeup = 0;
+	pthread_mutex_unlock(&s_wakeup_mutex);
+}
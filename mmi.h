@@ -13,6 +13,10 @@ typedef struct {
 	int line_index;        /**< selected line index */
 	int last_edited_step;  /**< last edited step number */
 	int beat_blink;        /**< beat blinker */
+	int learn;             /**< midi learn active */
+	int learn_action;      /**< midi learn target action */
+	int learn_arg;         /**< midi learn target argument */
+	int learn_control;     /**< last learned controller ((surface * 16 + channel) * 128 + cc) */
 } mmi_state_t;
 
 /**
@@ -27,10 +31,17 @@ int mmi_init(void);
 void mmi_shutdown(void);
 
 /**
- * Updates the mmi.
+ * Updates the mmi. Blocks until it is woken up by a beat, controller input
+ * or mmi_wakeup(), or until pending controller feedback is due. The screen is
+ * updated by its own thread.
  */
 void mmi_update(void);
 
+/**
+ * Wakes up mmi_update().
+ */
+void mmi_wakeup(void);
+
 /**
  * Called from the sequencer thread.
  * @param pulse Pulse
@@ -39,9 +50,20 @@ void mmi_update(void);
 void mmi_pulse(int pulse, mio_timestamp_t timestamp);
 
 /**
- * Returns the mmi state.
- * @return Returns the mmi state.
+ * Toggles the midi learn mode. While learning, each moved controller is
+ * mapped to the next action in turn. Stopping saves the cc map.
+ */
+void mmi_learn(void);
+
+/**
+ * Logs the input latency statistics of all control surfaces.
+ */
+void mmi_log_latency(void);
+
+/**
+ * Returns a consistent copy of the mmi state.
+ * @param state Returns the mmi state
  */
-mmi_state_t *mmi_get_state(void);
+void mmi_copy_state(mmi_state_t *state);
 
 #endif /*__MMI_H__*/
@@ -1,29 +1,67 @@
 
 #include <assert.h>
 
+#include "defines.h"
 #include "lightlist.h"
 #include "mio.h"
+#include "mtap.h"
 #include "mout.h"
 
 /** notes in note buffer */
 #define NUM_NOTES 1024
 
-/** maximum number of output streams */
-#define MAX_STREAMS 2
+/** output rate budget in bytes per second (din midi runs at 31250 baud) */
+#define RATE_BUDGET 3125
 
-static mio_stream_t *s_streams[MAX_STREAMS];
+/** maximum burst of the output rate budget in bytes */
+#define RATE_BURST 96
+
+/** controller numbers used by panic */
+#define CC_ALL_SOUND_OFF 120
+#define CC_ALL_NOTES_OFF 123
+
+/** output rate budget of a stream */
+typedef struct {
+	mio_timestamp_t last_time; /**< timestamp of last refill */
+	int credit;                /**< available credit in bytes * 1000 */
+} budget_t;
+
+static mio_stream_t *s_streams[MOUT_MAX_STREAMS];
+static budget_t s_budgets[MOUT_MAX_STREAMS];
+static int s_nrpn[MOUT_MAX_STREAMS][16];
 static mout_note_t s_note_buffer[NUM_NOTES];
 static struct list_head s_notes;
+static struct list_head s_active[MOUT_MAX_STREAMS][16];
+static mio_event_t s_stop_events[NUM_NOTES + 32];
+
+/* statistics, only written by the sequencer thread */
+static unsigned long s_events[MOUT_MAX_STREAMS];
+static unsigned long s_dropped;
+static int s_voices;
+
+static void output(int id, mio_event_t *buf, int len);
+static int use_budget(int id, int bytes, mio_timestamp_t timestamp, int optional);
+static void stop_all(int all_off);
+static void add_stat(unsigned long *counter, int n);
 
 /*
  * Initializes the midi output subsystem.
  */
 int mout_init(void)
 {
-	int i;
+	int i, j;
 	
 	INIT_LIST_HEAD(&s_notes);
 	
+	for (i = 0; i < MOUT_MAX_STREAMS; i++) {
+		s_budgets[i].last_time = 0;
+		s_budgets[i].credit = RATE_BURST * 1000;
+		for (j = 0; j < 16; j++) {
+			s_nrpn[i][j] = -1;
+			INIT_LIST_HEAD(&s_active[i][j]);
+		}
+	}
+	
 	for (i = 0; i < NUM_NOTES; i++)
 		list_add_tail(&s_note_buffer[i].item, &s_notes);
 	
@@ -43,7 +81,7 @@ void mout_shutdown(void)
  */
 void mout_register_output(int id, mio_stream_t *stream)
 {
-	assert(id >= 0 && id < MAX_STREAMS);
+	assert(id >= 0 && id < MOUT_MAX_STREAMS);
 	s_streams[id] = stream;
 }
 
@@ -52,7 +90,7 @@ void mout_register_output(int id, mio_stream_t *stream)
  */
 mio_stream_t *mout_get_output(int id)
 {
-	assert(id >= 0 && id < MAX_STREAMS);
+	assert(id >= 0 && id < MOUT_MAX_STREAMS);
 	return s_streams[id];
 }
 
@@ -68,26 +106,31 @@ mout_note_t *mout_play_note(int id, unsigned char channel, unsigned char note, u
 	if (!stream)
 		return NULL;
 	
-	/* get first note from buffer */
-	notebuf = list_entry(s_notes.next, mout_note_t, item);
-	
 	/* exit if there are no notes left */
-	if (notebuf->active)
+	if (list_empty(&s_notes)) {
+		add_stat(&s_dropped, 1);
 		return NULL;
+	}
+	
+	/* get first free note from buffer */
+	notebuf = list_entry(s_notes.next, mout_note_t, item);
 		
 	/* play the note */
 	event.message = mio_message(MIO_CMD_NOTE_ON, channel, note, vel);
 	event.timestamp = timestamp;
-	mio_write(stream, &event, 1);
+	output(id, &event, 1);
+	use_budget(id, 3, timestamp, 0);
 	
 	/* store the note */
 	notebuf->stream = stream;
+	notebuf->id = id;
 	notebuf->channel = channel;
 	notebuf->note = note;
 	notebuf->active = 1;
 	
-	/* move note to tail of list */
-	list_move_tail(&notebuf->item, &s_notes);
+	/* move note to the active list of its stream and channel */
+	list_move_tail(&notebuf->item, &s_active[id][channel]);
+	__atomic_store_n(&s_voices, s_voices + 1, __ATOMIC_RELAXED);
 	
 	return notebuf;
 }
@@ -108,11 +151,13 @@ void mout_stop_note(mout_note_t *note, mio_timestamp_t timestamp)
 	/* stop the note */
 	event.message = mio_message(MIO_CMD_NOTE_OFF, note->channel, note->note, 0);
 	event.timestamp = timestamp;
-	mio_write(note->stream, &event, 1);
+	output(note->id, &event, 1);
+	use_budget(note->id, 3, timestamp, 0);
 	
-	/* disable note and move to head of the list */
+	/* disable note and move back to the free list */
 	note->active = 0;
 	list_move(&note->item, &s_notes);
+	__atomic_store_n(&s_voices, s_voices - 1, __ATOMIC_RELAXED);
 }
 
 /*
@@ -123,10 +168,87 @@ void mout_set_cc(int id, unsigned char channel, unsigned char cc, unsigned char
 	mio_stream_t *stream = s_streams[id];
 	mio_event_t event;
 	
+	if (!stream)
+		return;
+	
 	/* send cc */
 	event.message = mio_message(MIO_CMD_CONTROL_CHANGE, channel, cc, value);
 	event.timestamp = timestamp;
-	mio_write(stream, &event, 1);
+	output(id, &event, 1);
+	use_budget(id, 3, timestamp, 0);
+}
+
+/*
+ * Sets a controller value in the given resolution.
+ */
+int mout_set_ctrl(int id, unsigned char channel, int res, unsigned char cc, int value, mio_timestamp_t timestamp, int optional)
+{
+	mio_stream_t *stream = s_streams[id];
+	mio_event_t events[4];
+	int i, count = 0;
+	int msb, lsb;
+	
+	if (!stream)
+		return -1;
+	
+	value = value < 0 ? 0 : value;
+	value = value > 16383 ? 16383 : value;
+	msb = value >> 7;
+	lsb = value & 0x7f;
+	
+	/* 14 bit controllers only exist for cc 0-31 */
+	if (res == CC_RES_14BIT && cc >= 32)
+		res = CC_RES_7BIT;
+	
+	switch (res) {
+	case CC_RES_14BIT:
+		events[count++].message = mio_message(MIO_CMD_CONTROL_CHANGE, channel, cc, msb);
+		events[count++].message = mio_message(MIO_CMD_CONTROL_CHANGE, channel, cc + 32, lsb);
+		break;
+	case CC_RES_NRPN:
+		/* only select the nrpn if it has changed */
+		if (s_nrpn[id][channel] != cc) {
+			events[count++].message = mio_message(MIO_CMD_CONTROL_CHANGE, channel, 99, 0);
+			events[count++].message = mio_message(MIO_CMD_CONTROL_CHANGE, channel, 98, cc);
+		}
+		events[count++].message = mio_message(MIO_CMD_CONTROL_CHANGE, channel, 6, msb);
+		events[count++].message = mio_message(MIO_CMD_CONTROL_CHANGE, channel, 38, lsb);
+		break;
+	case CC_RES_BEND:
+		events[count++].message = mio_message(MIO_CMD_PITCH_WHEEL, channel, lsb, msb);
+		break;
+	default:
+		events[count++].message = mio_message(MIO_CMD_CONTROL_CHANGE, channel, cc, msb);
+		break;
+	}
+	
+	if (use_budget(id, count * 3, timestamp, optional) != 0) {
+		add_stat(&s_dropped, 1);
+		return -1;
+	}
+	
+	if (res == CC_RES_NRPN)
+		s_nrpn[id][channel] = cc;
+	
+	for (i = 0; i < count; i++)
+		events[i].timestamp = timestamp;
+	output(id, events, count);
+	
+	return 0;
+}
+
+/*
+ * Returns the output statistics.
+ */
+void mout_get_stats(mout_stats_t *stats)
+{
+	int i;
+	
+	for (i = 0; i < MOUT_MAX_STREAMS; i++)
+		stats->events[i] = __atomic_load_n(&s_events[i], __ATOMIC_RELAXED);
+	stats->dropped = __atomic_load_n(&s_dropped, __ATOMIC_RELAXED);
+	stats->voices = __atomic_load_n(&s_voices, __ATOMIC_RELAXED);
+	stats->max_voices = NUM_NOTES;
 }
 
 /*
@@ -134,9 +256,113 @@ void mout_set_cc(int id, unsigned char channel, unsigned char cc, unsigned char
  */
 void mout_stop_all(void)
 {
-	mout_note_t *note;
+	stop_all(0);
+}
+
+/*
+ * Stops all previously played notes and sends all notes off and all sound off
+ * on every channel.
+ */
+void mout_panic(void)
+{
+	stop_all(1);
+}
+
+/**
+ * Writes events to an output stream and passes them to the tap.
+ * @param id Stream id
+ * @param buf Event buffer
+ * @param len Length of event buffer
+ */
+static void output(int id, mio_event_t *buf, int len)
+{
+	mio_write(s_streams[id], buf, len);
+	mtap_put(id, buf, len);
+	add_stat(&s_events[id], len);
+}
+
+/**
+ * Adds to a statistics counter. There is a single writer, so the counter
+ * only needs to be stored atomically for readers in other threads.
+ * @param counter Counter
+ * @param n Amount to add
+ */
+static void add_stat(unsigned long *counter, int n)
+{
+	__atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * Refills a stream's rate budget and uses the given amount of bytes from it.
+ * Mandatory messages always pass (and may overdraw the budget), optional
+ * messages are rejected if there is not enough credit left.
+ * @param id Stream id
+ * @param bytes Number of bytes to send
+ * @param timestamp Timestamp of the message
+ * @param optional Message is optional
+ * @return Returns 0 if the message may be sent.
+ */
+static int use_budget(int id, int bytes, mio_timestamp_t timestamp, int optional)
+{
+	budget_t *budget = &s_budgets[id];
+	long long credit;
+	
+	/* refill credit, computed in long long as idle streams would overflow an int */
+	if (timestamp > budget->last_time) {
+		credit = budget->credit + (long long) (timestamp - budget->last_time) * RATE_BUDGET;
+		if (credit > RATE_BURST * 1000)
+			credit = RATE_BURST * 1000;
+		budget->credit = credit;
+		budget->last_time = timestamp;
+	}
+	
+	if (optional && budget->credit < bytes * 1000)
+		return -1;
+	
+	budget->credit -= bytes * 1000;
+	
+	return 0;
+}
+
+/**
+ * Stops all active notes. Only the active lists are visited, and the note
+ * offs of each stream are sent in a single write.
+ * @param all_off Also send all notes off and all sound off on every channel
+ */
+static void stop_all(int all_off)
+{
+	mout_note_t *note, *next;
+	mio_event_t *event;
+	mio_timestamp_t timestamp = mio_get_timestamp();
+	int id, channel, count;
 	
-	list_for_each_entry(note, &s_notes, item)
-		if (note->active)
-			mout_stop_note(note, mio_get_timestamp());
+	for (id = 0; id < MOUT_MAX_STREAMS; id++) {
+		if (!s_streams[id])
+			continue;
+		
+		count = 0;
+		for (channel = 0; channel < 16; channel++) {
+			list_for_each_entry_safe(note, next, &s_active[id][channel], item) {
+				event = &s_stop_events[count++];
+				event->message = mio_message(MIO_CMD_NOTE_OFF, channel, note->note, 0);
+				event->timestamp = timestamp;
+				note->active = 0;
+				list_move(&note->item, &s_notes);
+				__atomic_store_n(&s_voices, s_voices - 1, __ATOMIC_RELAXED);
+			}
+			if (all_off) {
+				event = &s_stop_events[count++];
+				event->message = mio_message(MIO_CMD_CONTROL_CHANGE, channel, CC_ALL_NOTES_OFF, 0);
+				event->timestamp = timestamp;
+				event = &s_stop_events[count++];
+				event->message = mio_message(MIO_CMD_CONTROL_CHANGE, channel, CC_ALL_SOUND_OFF, 0);
+				event->timestamp = timestamp;
+			}
+		}
+		
+		if (count) {
+			output(id, s_stop_events, count);
+			use_budget(id, count * 3, timestamp, 0);
+		}
+	}
 }
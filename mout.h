@@ -4,10 +4,22 @@
 #include "lightlist.h"
 #include "mio.h"
 
+/** maximum number of output streams */
+#define MOUT_MAX_STREAMS 2
+
+/** output statistics, counted since start */
+typedef struct {
+	unsigned long events[MOUT_MAX_STREAMS]; /**< events written to each stream */
+	unsigned long dropped;                  /**< optional values over budget and notes without a free voice */
+	int voices;                             /**< notes currently playing */
+	int max_voices;                         /**< size of the note pool */
+} mout_stats_t;
+
 /** note object */
 typedef struct {
 	struct list_head item;
 	mio_stream_t *stream;
+	unsigned char id;
 	unsigned char channel;
 	unsigned char note;
 	unsigned char active;
@@ -66,9 +78,38 @@ void mout_stop_note(mout_note_t *note, mio_timestamp_t timestamp);
  */
 void mout_set_cc(int id, unsigned char channel, unsigned char cc, unsigned char value, mio_timestamp_t timestamp);
 
+/**
+ * Sets a controller value in the given resolution. Optional values (e.g.
+ * interpolated values) are dropped if the stream's message rate budget is
+ * exhausted.
+ * @param id Stream id
+ * @param channel Midi channel
+ * @param res Controller resolution (CC_RES_xxx)
+ * @param cc CC or NRPN number
+ * @param value 14 bit controller value (0-16383)
+ * @param timestamp Timestamp
+ * @param optional Value may be dropped if set
+ * @return Returns 0 if the value was sent, -1 if it was dropped.
+ */
+int mout_set_ctrl(int id, unsigned char channel, int res, unsigned char cc, int value, mio_timestamp_t timestamp, int optional);
+
+/**
+ * Returns the output statistics. The counters are written by the
+ * sequencer thread without locking and can be read from any thread.
+ * @param stats Returns the statistics
+ */
+void mout_get_stats(mout_stats_t *stats);
+
 /**
  * Stops all previously played notes.
  */
 void mout_stop_all(void);
 
+/**
+ * Stops all previously played notes and sends all notes off (cc 123) and
+ * all sound off (cc 120) on every channel of every output stream. Used as a
+ * fallback for notes not played by mout.
+ */
+void mout_panic(void);
+
 #endif /*__MOUT_H__*/
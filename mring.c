@@ -0,0 +1,98 @@
+
+#include "mio.h"
+#include "mring.h"
+
+/*
+ * Initializes an input ring.
+ */
+void mring_init(mring_t *ring, mio_stream_t *stream)
+{
+	ring->stream = stream;
+	ring->head = 0;
+	ring->num_subscribers = 0;
+}
+
+/*
+ * Subscribes to an input ring.
+ */
+int mring_subscribe(mring_t *ring)
+{
+	if (ring->num_subscribers == MRING_MAX_SUBSCRIBERS)
+		return -1;
+	
+	ring->cursors[ring->num_subscribers] = ring->head;
+	
+	return ring->num_subscribers++;
+}
+
+/*
+ * Reads events from the input stream into the free space of the ring.
+ */
+int mring_fill(mring_t *ring)
+{
+	unsigned int tail = ring->head;
+	long long now;
+	int i, len, n, count = 0;
+	
+	/* the slowest subscriber limits the free space */
+	for (i = 0; i < ring->num_subscribers; i++)
+		if (ring->head - ring->cursors[i] > ring->head - tail)
+			tail = ring->cursors[i];
+	
+	for (;;) {
+		len = MRING_LEN - (ring->head % MRING_LEN);
+		if (len > MRING_LEN - (int) (ring->head - tail))
+			len = MRING_LEN - (ring->head - tail);
+		if (len == 0)
+			break;
+		
+		n = mio_read(ring->stream, &ring->events[ring->head % MRING_LEN], len);
+		if (n <= 0)
+			break;
+		
+		now = lat_now();
+		for (i = 0; i < n; i++)
+			ring->read_times[(ring->head + i) % MRING_LEN] = now;
+		
+		ring->head += n;
+		count += n;
+		
+		/* a partial read means the stream is empty */
+		if (n < len)
+			break;
+	}
+	
+	return count;
+}
+
+/*
+ * Returns the events a subscriber has not consumed yet.
+ */
+int mring_peek(mring_t *ring, int subscriber, const mio_event_t **events)
+{
+	unsigned int cursor = ring->cursors[subscriber];
+	int count = ring->head - cursor;
+	
+	if (count > MRING_LEN - (int) (cursor % MRING_LEN))
+		count = MRING_LEN - (cursor % MRING_LEN);
+	
+	*events = &ring->events[cursor % MRING_LEN];
+	
+	return count;
+}
+
+/*
+ * Returns the time an event of the ring was read.
+ */
+long long mring_get_read_time(mring_t *ring, const mio_event_t *event)
+{
+	return ring->read_times[event - ring->events];
+}
+
+/*
+ * Marks events as consumed by a subscriber.
+ */
+void mring_consume(mring_t *ring, int subscriber, int count)
+{
+	ring->cursors[subscriber] += count;
+}
@@ -0,0 +1,78 @@
+#ifndef __MRING_H__
+#define __MRING_H__
+
+#include "lat.h"
+#include "mio.h"
+
+/** number of events an input ring can hold (power of two) */
+#define MRING_LEN 1024
+
+/** maximum number of subscribers of an input ring */
+#define MRING_MAX_SUBSCRIBERS 4
+
+/**
+ * Preallocated ring of events read from an input stream. Events are read
+ * once and consumed in place by all subscribers, each with its own cursor.
+ * The ring is not thread safe, filling and consuming must happen in the
+ * same thread.
+ */
+typedef struct {
+	mio_stream_t *stream;
+	mio_event_t events[MRING_LEN];
+	long long read_times[MRING_LEN];              /**< time each event was read, see lat_now() */
+	unsigned int head;                            /**< number of events read */
+	unsigned int cursors[MRING_MAX_SUBSCRIBERS];  /**< number of events consumed by each subscriber */
+	int num_subscribers;
+} mring_t;
+
+/**
+ * Initializes an input ring.
+ * @param ring Input ring
+ * @param stream Input stream
+ */
+void mring_init(mring_t *ring, mio_stream_t *stream);
+
+/**
+ * Subscribes to an input ring. The subscriber sees all events read after
+ * subscribing.
+ * @param ring Input ring
+ * @return Returns the subscriber id or -1 if there are too many subscribers.
+ */
+int mring_subscribe(mring_t *ring);
+
+/**
+ * Reads events from the input stream into the free space of the ring. Space
+ * is free once all subscribers have consumed it.
+ * @param ring Input ring
+ * @return Returns the number of events read.
+ */
+int mring_fill(mring_t *ring);
+
+/**
+ * Returns the events a subscriber has not consumed yet, up to the end of
+ * the ring. Call again after consuming to get wrapped around events.
+ * @param ring Input ring
+ * @param subscriber Subscriber id
+ * @param events Returns a pointer to the first event
+ * @return Returns the number of events.
+ */
+int mring_peek(mring_t *ring, int subscriber, const mio_event_t **events);
+
+/**
+ * Returns the time an event of the ring was read. Unlike the event timestamp
+ * it has us resolution.
+ * @param ring Input ring
+ * @param event Event returned by mring_peek()
+ * @return Returns the time in us, see lat_now().
+ */
+long long mring_get_read_time(mring_t *ring, const mio_event_t *event);
+
+/**
+ * Marks events as consumed by a subscriber.
+ * @param ring Input ring
+ * @param subscriber Subscriber id
+ * @param count Number of events
+ */
+void mring_consume(mring_t *ring, int subscriber, int count);
+
+#endif /*__MRING_H__*/
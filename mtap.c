@@ -0,0 +1,275 @@
+
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "mio.h"
+#include "mtap.h"
+
+/** number of records in the ring buffer (power of two) */
+#define RING_LEN 4096
+
+/** writer thread poll interval in us */
+#define WRITER_INTERVAL 10000
+
+static mtap_record_t s_ring[RING_LEN];
+static unsigned int s_head;
+static unsigned int s_tail;
+static unsigned int s_drops;
+static int s_enabled = 0;
+
+static FILE *s_file;
+static mtap_format_t s_format;
+static pthread_t s_thread;
+static int s_thread_stop;
+
+static int s_smf_port;
+static mio_timestamp_t s_smf_time;
+static long s_smf_track_start;
+
+static void *writer_thread(void *data);
+static void drain(void);
+static void write_smf_header(void);
+static void write_smf_event(mtap_record_t *record);
+static void finish_smf(void);
+static void write_var_len(unsigned long value);
+static void write_be(unsigned long value, int bytes);
+
+/*
+ * Opens the tap file and starts the thread writing captured events to it.
+ */
+int mtap_open(const char *filename, mtap_format_t format)
+{
+	s_file = fopen(filename, "wb");
+	if (!s_file) {
+		LOG(LOG_ERROR, "cannot open tap file '%s'", filename);
+		return -1;
+	}
+	
+	s_format = format;
+	s_head = 0;
+	s_tail = 0;
+	s_drops = 0;
+	
+	if (s_format == MTAP_FORMAT_SMF)
+		write_smf_header();
+	
+	s_thread_stop = 0;
+	if (pthread_create(&s_thread, NULL, writer_thread, NULL)) {
+		LOG(LOG_ERROR, "cannot create tap writer thread");
+		fclose(s_file);
+		return -1;
+	}
+	
+	__atomic_store_n(&s_enabled, 1, __ATOMIC_RELEASE);
+	
+	return 0;
+}
+
+/*
+ * Stops the writer thread, flushes remaining events and closes the file.
+ */
+void mtap_close(void)
+{
+	if (!s_enabled)
+		return;
+	
+	__atomic_store_n(&s_enabled, 0, __ATOMIC_RELEASE);
+	
+	s_thread_stop = 1;
+	pthread_join(s_thread, NULL);
+	
+	drain();
+	
+	if (s_format == MTAP_FORMAT_SMF)
+		finish_smf();
+	
+	fclose(s_file);
+	
+	if (s_drops)
+		LOG(LOG_INFO, "tap dropped %u events", s_drops);
+}
+
+/*
+ * Copies outgoing events into the tap ring buffer.
+ */
+void mtap_put(int id, mio_event_t *buf, int len)
+{
+	unsigned int head, tail;
+	int i;
+	
+	if (!__atomic_load_n(&s_enabled, __ATOMIC_ACQUIRE))
+		return;
+	
+	head = s_head;
+	tail = __atomic_load_n(&s_tail, __ATOMIC_ACQUIRE);
+	
+	for (i = 0; i < len; i++) {
+		if (head - tail >= RING_LEN) {
+			__atomic_add_fetch(&s_drops, len - i, __ATOMIC_RELAXED);
+			break;
+		}
+		s_ring[head % RING_LEN].id = id;
+		s_ring[head % RING_LEN].event = buf[i];
+		head++;
+	}
+	
+	__atomic_store_n(&s_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns the number of events dropped because the ring buffer was full.
+ */
+unsigned int mtap_get_drops(void)
+{
+	return __atomic_load_n(&s_drops, __ATOMIC_RELAXED);
+}
+
+/**
+ * Writer thread, periodically drains the ring buffer to the file.
+ * @param data User data
+ * @return Return code.
+ */
+static void *writer_thread(void *data)
+{
+	while (!s_thread_stop) {
+		drain();
+		usleep(WRITER_INTERVAL);
+	}
+	
+	pthread_exit(NULL);
+}
+
+/**
+ * Writes all records in the ring buffer to the file.
+ */
+static void drain(void)
+{
+	unsigned int head, tail;
+	mtap_record_t *record;
+	
+	head = __atomic_load_n(&s_head, __ATOMIC_ACQUIRE);
+	
+	for (tail = s_tail; tail != head; tail++) {
+		record = &s_ring[tail % RING_LEN];
+		if (s_format == MTAP_FORMAT_SMF)
+			write_smf_event(record);
+		else
+			fwrite(record, sizeof(mtap_record_t), 1, s_file);
+	}
+	
+	__atomic_store_n(&s_tail, tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * Writes the smf header and the start of the track. The track length is
+ * filled in by finish_smf().
+ */
+static void write_smf_header(void)
+{
+	fwrite("MThd", 4, 1, s_file);
+	write_be(6, 4);
+	write_be(0, 2);     /* format 0 */
+	write_be(1, 2);     /* one track */
+	write_be(1000, 2);  /* 1000 ticks per quarter */
+	
+	fwrite("MTrk", 4, 1, s_file);
+	s_smf_track_start = ftell(s_file);
+	write_be(0, 4);
+	
+	/* tempo of 1s per quarter, so a tick is 1ms */
+	write_var_len(0);
+	fputc(0xff, s_file);
+	fputc(0x51, s_file);
+	fputc(0x03, s_file);
+	write_be(1000000, 3);
+	
+	s_smf_port = -1;
+	s_smf_time = -1;
+}
+
+/**
+ * Writes a single event to the smf track.
+ * @param record Tap record
+ */
+static void write_smf_event(mtap_record_t *record)
+{
+	mio_message_t message = record->event.message;
+	mio_timestamp_t delta;
+	int cmd = mio_message_cmd(message);
+	
+	if (s_smf_time < 0)
+		s_smf_time = record->event.timestamp;
+	
+	/* events may be written out of order, e.g. by a panic */
+	delta = record->event.timestamp - s_smf_time;
+	if (delta < 0)
+		delta = 0;
+	s_smf_time += delta;
+	
+	/* write midi port meta event if the stream changes */
+	if (record->id != s_smf_port) {
+		write_var_len(delta);
+		fputc(0xff, s_file);
+		fputc(0x21, s_file);
+		fputc(0x01, s_file);
+		fputc(record->id, s_file);
+		s_smf_port = record->id;
+		delta = 0;
+	}
+	
+	write_var_len(delta);
+	fputc(mio_message_status(message), s_file);
+	fputc(mio_message_data1(message), s_file);
+	if (cmd != MIO_CMD_PROGRAM_CHANGE && cmd != MIO_CMD_CHANNEL_PRESSURE)
+		fputc(mio_message_data2(message), s_file);
+}
+
+/**
+ * Writes the end of track event and fills in the track length.
+ */
+static void finish_smf(void)
+{
+	long end;
+	
+	write_var_len(0);
+	fputc(0xff, s_file);
+	fputc(0x2f, s_file);
+	fputc(0x00, s_file);
+	
+	end = ftell(s_file);
+	fseek(s_file, s_smf_track_start, SEEK_SET);
+	write_be(end - s_smf_track_start - 4, 4);
+	fseek(s_file, end, SEEK_SET);
+}
+
+/**
+ * Writes a variable length quantity.
+ * @param value Value
+ */
+static void write_var_len(unsigned long value)
+{
+	unsigned char buf[5];
+	int count = 0;
+	
+	do {
+		buf[count++] = value & 0x7f;
+		value >>= 7;
+	} while (value);
+	
+	while (count > 1)
+		fputc(buf[--count] | 0x80, s_file);
+	fputc(buf[0], s_file);
+}
+
+/**
+ * Writes a big endian value.
+ * @param value Value
+ * @param bytes Number of bytes
+ */
+static void write_be(unsigned long value, int bytes)
+{
+	while (bytes--)
+		fputc((value >> (bytes * 8)) & 0xff, s_file);
+}
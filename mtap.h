@@ -0,0 +1,47 @@
+#ifndef __MTAP_H__
+#define __MTAP_H__
+
+#include "mio.h"
+
+/** tap file formats */
+typedef enum {
+	MTAP_FORMAT_RAW,  /**< sequence of mtap_record_t */
+	MTAP_FORMAT_SMF,  /**< standard midi file (format 0, 1 tick = 1 ms) */
+} mtap_format_t;
+
+/** raw tap file record */
+typedef struct {
+	int id;             /**< output stream id */
+	mio_event_t event;  /**< event as written to the stream */
+} mtap_record_t;
+
+/**
+ * Opens the tap file and starts the thread writing captured events to it.
+ * @param filename Filename
+ * @param format File format
+ * @return Returns 0 if successful.
+ */
+int mtap_open(const char *filename, mtap_format_t format);
+
+/**
+ * Stops the writer thread, flushes remaining events and closes the file.
+ */
+void mtap_close(void);
+
+/**
+ * Copies outgoing events into the tap ring buffer. Never blocks, events not
+ * fitting into the ring buffer are counted as dropped. Calls must not be
+ * made concurrently (mout is only called by one thread at a time).
+ * @param id Output stream id
+ * @param buf Event buffer
+ * @param len Length of event buffer
+ */
+void mtap_put(int id, mio_event_t *buf, int len);
+
+/**
+ * Returns the number of events dropped because the ring buffer was full.
+ * @return Returns the number of dropped events.
+ */
+unsigned int mtap_get_drops(void);
+
+#endif /*__MTAP_H__*/
@@ -32,6 +32,8 @@ struct line {
 	param_t midi_cc;
 	param_t velocity;
 	param_t add;
+	param_t slew;
+	param_t cc_res;
 
 	param_t *params[NUM_LINE_PARAMS];
 		
@@ -44,6 +46,10 @@ struct line {
 	int cur_step;
 	int prev_step;
 	int direction;
+	unsigned int kept;          /**< steps recorded ahead of the playhead (one bit per step) */
+	
+	int slew_from;              /**< 14 bit controller value at step start */
+	int slew_to;                /**< 14 bit controller value of next step */
 	
 	mout_note_t *played_note;
 	
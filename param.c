@@ -200,7 +200,10 @@ void param_get_str(param_t *param, char *str, int len)
 
 	if ((param->flags & PARAM_FLAG_CAN_CONNECT) && (param->value > param->class_def->max)) {
 		source = param->value - param->class_def->max - 1;
-		snprintf(str, len, "L%d%s", source % NUM_LINES + 1, source >= NUM_LINES ? "s" : ""); 
+		if (source == SOURCE_TRANSPOSE)
+			snprintf(str, len, "Kbd");
+		else
+			snprintf(str, len, "L%d%s", source % NUM_LINES + 1, source >= NUM_LINES ? "s" : ""); 
 	} else {
 		param->class_def->print_value(param->class_def, param->value, str, len);
 	}
@@ -57,6 +57,23 @@ static enum_entry_t s_enum_table_sync_mode[] = {
 	{ "Manual", SYNC_MODE_MANUAL },
 };
 
+/* slew table (pulses between interpolated values) */
+static enum_entry_t s_enum_table_slew[] = {
+	{ "Off",   0 },
+	{ "1 Pls", 1 },
+	{ "2 Pls", 2 },
+	{ "3 Pls", 3 },
+	{ "6 Pls", 6 },
+};
+
+/* controller resolution table */
+static enum_entry_t s_enum_table_cc_res[] = {
+	{ "7 Bit",  CC_RES_7BIT },
+	{ "14 Bit", CC_RES_14BIT },
+	{ "NRPN",   CC_RES_NRPN },
+	{ "Bend",   CC_RES_BEND },
+};
+
 /* PARAMATER print_value FUNCTIONS ----------------------------------------- */
 
 static void print_value_none(param_class_def_t *class_def, int value, char *str, int len);
@@ -242,6 +259,26 @@ static param_class_def_t s_param_classes[] = {
 		.cc_sens = 1,
 		.enum_table = NULL,
 		.print_value = print_value_int,
+	}, {
+		.class = PARAM_CLASS_SLEW,
+		.name = "Slew",
+		.typ = PARAM_ENUM,
+		.def = 0,
+		.min = 0,
+		.max = ENUM_TABLE_MAX(s_enum_table_slew),
+		.cc_sens = 5,
+		.enum_table = s_enum_table_slew,
+		.print_value = print_value_enum,
+	}, {
+		.class = PARAM_CLASS_CC_RES,
+		.name = "Resolution",
+		.typ = PARAM_ENUM,
+		.def = 0,
+		.min = 0,
+		.max = ENUM_TABLE_MAX(s_enum_table_cc_res),
+		.cc_sens = 5,
+		.enum_table = s_enum_table_cc_res,
+		.print_value = print_value_enum,
 	}
 };
 
@@ -22,6 +22,8 @@ typedef enum {
 	PARAM_CLASS_VELOCITY,
 	PARAM_CLASS_ADD,
 	PARAM_CLASS_BPM,
+	PARAM_CLASS_SLEW,
+	PARAM_CLASS_CC_RES,
 	PARAM_CLASS_LAST,
 } param_class_t;
 
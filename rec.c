@@ -0,0 +1,151 @@
+
+#include <stdlib.h>
+
+#include "log.h"
+#include "line.h"
+#include "seq.h"
+#include "transpose.h"
+#include "rec.h"
+
+static rec_mode_t s_mode = REC_OFF;
+static line_t *s_line;
+static int s_last_step = -1;
+
+static const char *s_mode_names[] = { "Off", "Overdub", "Replace" };
+
+static int record_note(const mio_event_t *event);
+static line_t *get_velocity_line(line_t *line, int *sync);
+
+/*
+ * Sets the record mode.
+ */
+void rec_set_mode(rec_mode_t mode)
+{
+	s_last_step = -1;
+	s_mode = mode;
+	LOG(LOG_INFO, "record mode %s", s_mode_names[mode]);
+}
+
+/*
+ * Returns the record mode.
+ */
+rec_mode_t rec_get_mode(void)
+{
+	return s_mode;
+}
+
+/*
+ * Returns the name of the record mode.
+ */
+const char *rec_get_mode_name(rec_mode_t mode)
+{
+	return s_mode_names[mode];
+}
+
+/*
+ * Sets the line to record into.
+ */
+void rec_set_line(line_t *line)
+{
+	s_last_step = -1;
+	s_line = line;
+}
+
+/*
+ * Records the note on events of the sequencer input.
+ */
+int rec_process(const mio_event_t *events, int count)
+{
+	int i;
+	int recorded = 0;
+	
+	if (s_mode == REC_OFF || !s_line)
+		return 0;
+	
+	for (i = 0; i < count; i++)
+		recorded += record_note(&events[i]);
+	
+	return recorded;
+}
+
+/*
+ * Called by the sequencer on each clock pulse.
+ */
+void rec_pulse(int pulse)
+{
+	line_t *line = s_line;
+	
+	if (s_mode != REC_REPLACE || !line || line->cur_step < 0)
+		return;
+	
+	/* steps kept while not replacing must be cleared */
+	if (s_last_step < 0)
+		line->kept = 0;
+	
+	/* clear each step as soon as the playhead enters it, unless it was
+	 * recorded ahead of the playhead in this pass */
+	if (line->cur_step != s_last_step) {
+		s_last_step = line->cur_step;
+		line_clear_step(line, line->cur_step);
+	}
+}
+
+/**
+ * Records a note on event into the step nearest to its arrival time.
+ * @param event Event
+ * @return Returns 1 if the note was recorded.
+ */
+static int record_note(const mio_event_t *event)
+{
+	line_t *line = s_line;
+	line_t *vel_line;
+	int note, vel, step, sync;
+	
+	if (mio_message_cmd(event->message) != MIO_CMD_NOTE_ON || transpose_is_key(event))
+		return 0;
+	if (param_get_enum(&line->line_mode) == LINE_MODE_OFF)
+		return 0;
+	
+	note = mio_message_data1(event->message);
+	vel = mio_message_data2(event->message);
+	if (vel == 0)
+		return 0;
+	
+	step = seq_record_step(line, -1, event->timestamp, note);
+	if (step < 0)
+		return 0;
+	
+	vel_line = get_velocity_line(line, &sync);
+	if (vel_line)
+		seq_record_step(vel_line, sync ? step : -1, event->timestamp, vel);
+	
+	return 1;
+}
+
+/**
+ * Returns the velocity line linked to a line.
+ * @param line Line
+ * @param sync Set to 1 if the velocity line follows the steps of the line
+ * @return Returns the velocity line or NULL if not linked.
+ */
+static line_t *get_velocity_line(line_t *line, int *sync)
+{
+	line_t *vel_line;
+	int index;
+	
+	if (!param_is_connected(&line->velocity))
+		return NULL;
+	
+	/* the transpose source is not a line */
+	index = param_get_connected_index(&line->velocity);
+	if (index < 0 || index >= 2 * NUM_LINES)
+		return NULL;
+	
+	*sync = index / NUM_LINES;
+	vel_line = &line->sequence->lines[index % NUM_LINES];
+	
+	if (param_get_enum(&vel_line->line_mode) != LINE_MODE_VEL)
+		return NULL;
+	
+	return vel_line;
+}
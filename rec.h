@@ -0,0 +1,56 @@
+#ifndef __REC_H__
+#define __REC_H__
+
+#include "mio.h"
+#include "objects.h"
+
+/** record modes */
+typedef enum {
+	REC_OFF,
+	REC_OVERDUB,                /**< notes are added to the existing steps */
+	REC_REPLACE,                /**< steps passed without a note are cleared */
+	REC_MODE_LAST,
+} rec_mode_t;
+
+/**
+ * Sets the record mode.
+ * @param mode Record mode
+ */
+void rec_set_mode(rec_mode_t mode);
+
+/**
+ * Returns the record mode.
+ * @return Returns the record mode.
+ */
+rec_mode_t rec_get_mode(void);
+
+/**
+ * Returns the name of the record mode.
+ * @param mode Record mode
+ * @return Returns the name of the record mode.
+ */
+const char *rec_get_mode_name(rec_mode_t mode);
+
+/**
+ * Sets the line to record into. If the velocity of the line is connected
+ * to a velocity line, note velocities are recorded into that line.
+ * @param line Line
+ */
+void rec_set_line(line_t *line);
+
+/**
+ * Records the note on events of the sequencer input. Notes of the transpose
+ * keyboard are not recorded.
+ * @param events Events
+ * @param count Number of events
+ * @return Returns the number of recorded notes.
+ */
+int rec_process(const mio_event_t *events, int count);
+
+/**
+ * Called by the sequencer on each clock pulse.
+ * @param pulse Pulse
+ */
+void rec_pulse(int pulse);
+
+#endif /* __REC_H__ */
@@ -1,31 +1,72 @@
 
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "SDL.h"
-#include "SDL/SDL_gfxPrimitives.h"
+#include "SDL2_gfxPrimitives.h"
 
 #include "log.h"
+#include "lat.h"
+#include "label.h"
 #include "core.h"
+#include "mio.h"
+#include "mout.h"
 #include "param.h"
 #include "seq.h"
+#include "rec.h"
+#include "ccmap.h"
 #include "pattern.h"
 #include "line.h"
 #include "mmi.h"
 #include "screen.h"
 
-/* dimensions */
-#define LINE_HEIGHT 50
-#define STEP_WIDTH 40
-#define STEP_BORDER 10
-#define HEADER_HEIGHT LINE_HEIGHT
+/* minimum window size, below the 8 pixel font no longer fits */
+#define MIN_WIDTH      (NUM_STEPS * 12)
+#define MIN_HEIGHT     ((NUM_LINES + 2) * 24)
 
-#define WIDTH	(NUM_STEPS * STEP_WIDTH)
-#define HEIGHT	(((NUM_LINES + 1) * LINE_HEIGHT) + HEADER_HEIGHT)
+/** number of overview rows, one row of steps for each line of each sequence */
+#define OVERVIEW_ROWS  (NUM_SEQUENCES * NUM_LINES)
+
+/** maximum length of a header field */
+#define FIELD_LEN 64
+
+/* step cell flags */
+#define STEP_ACTIVE   0x01
+#define STEP_FIRST    0x02
+#define STEP_LAST     0x04
+
+/* performance hud position and size */
+#define HUD_LINES     6
+#define HUD_LINE_LEN  80
+#define HUD_WIDTH     380
+#define HUD_HEIGHT    (HUD_LINES * 12 + 8)
+
+/** interval of performance hud updates in us */
+#define HUD_INTERVAL 250000
+
+/* maximum number of fills, markers and labels batched in one frame */
+#define MAX_FILLS   (NUM_LINES * NUM_STEPS * 8 + NUM_LINE_PARAMS)
+#define MAX_MARKERS (NUM_LINES * 2)
+#define MAX_LABELS  (NUM_LINES * NUM_STEPS + NUM_LINE_PARAMS)
 
 /** window title */
 #define WINDOW_TITLE "ssq-32"
 
+/** maximum time in ms the render thread waits (for handling window events) */
+#define EVENT_TIMEOUT 20
+
+/** frame period in us while playing without a frame rate limit */
+#define PLAYING_FRAME_PERIOD 16666
+
+/** number of full frames drawn by the draw benchmark */
+#define BENCHMARK_FRAMES 100
+
 /** predefined colors */
 typedef enum {
 	COLOR_BLACK,
@@ -36,14 +77,100 @@ typedef enum {
 	COLOR_STEP_SKIP,
 	COLOR_STEP_ACTIVE,
 	COLOR_FIRST_LAST,
+	COLOR_STEP_OUTSIDE,
+	COLOR_LINE,
+	COLOR_LINE_SELECTED,
 	COLOR_LAST,
 } color_t;
 
+/** layers of batched fills, drawn from bottom to top */
+typedef enum {
+	LAYER_BACKGROUND,
+	LAYER_STEP,
+	LAYER_BORDER,
+	LAYER_LAST,
+} layer_t;
+
+/** views */
+typedef enum {
+	VIEW_DETAIL,           /**< steps and parameters of the selected sequence */
+	VIEW_OVERVIEW,         /**< steps of all sequences */
+} view_t;
+
+/** header fields */
+typedef enum {
+	FIELD_RUN_STATE,
+	FIELD_TEMPO,
+	FIELD_PULSE,
+	FIELD_TIME,
+	FIELD_POSITION,
+	FIELD_REC,
+	FIELD_LEARN,
+	FIELD_LAST,
+} field_t;
+
+/** cell geometry, computed from the window size */
+typedef struct {
+	int width;
+	int height;
+	int header_height;
+	int line_height;
+	int step_width;
+	int step_border;                /**< height of the step mode bar */
+	int param_height;               /**< height of a line parameter cell */
+	int overview_row_height;
+	int field_x[FIELD_LAST + 1];    /**< header field positions, the last entry is the right end */
+	int hud_x;
+	int hud_y;
+} layout_t;
+
+/** batched fill, the key sorts the fills by layer and color */
+typedef struct {
+	int key;
+	SDL_Rect rect;
+} fill_t;
+
+/** batched first and last step marker */
+typedef struct {
+	Sint16 x[3];
+	Sint16 y[3];
+} marker_t;
+
+/** batched label */
+typedef struct {
+	int x;
+	int y;
+	int width;
+	param_t *param;
+	int named;
+} label_ref_t;
+
+/** contents of a step cell, the cell is redrawn when they change */
+typedef struct {
+	int mode;
+	int value;
+	int class;             /**< class of the value, which the line mode sets */
+	int flags;
+	int playhead;          /**< width of the playhead bar, -1 if the step is not playing */
+} step_cell_t;
+
+/** contents of a line parameter cell, the cell is redrawn when they change */
+typedef struct {
+	param_t *param;        /**< parameter in the slot, which depends on the line mode */
+	int class;
+	int value;
+} param_cell_t;
+
+/** contents of an overview row, the changed part of the row is redrawn */
+typedef struct {
+	unsigned char colors[NUM_STEPS];
+	int selected;
+} overview_row_t;
+
 /** color entry */
 typedef struct {
 	color_t color;
 	unsigned char r, g, b, a;
-	Uint32 sdl_color;
 } color_entry_t;
 
 /* color table */
@@ -56,23 +183,118 @@ static color_entry_t s_color_table[] = {
 	{ COLOR_STEP_SKIP,       150, 150, 0,   255 },
 	{ COLOR_STEP_ACTIVE,     255, 255, 0,   255 },
 	{ COLOR_FIRST_LAST,      255, 255, 255, 255 },
+	{ COLOR_STEP_OUTSIDE,    50,  50,  50,  255 },
+	{ COLOR_LINE,            0,   0,   50,  255 },
+	{ COLOR_LINE_SELECTED,   0,   0,   150, 255 },
 }; 
 
 static int s_dirty = 1;
-static SDL_Surface *s_screen;
+static int s_full_redraw = 1;
+static SDL_Window *s_window;
+static SDL_Renderer *s_renderer;
+static const char *s_renderer_name;
+static SDL_Texture *s_canvas;
+static layout_t s_layout;
 static pattern_t *s_pattern;
-static mmi_state_t *s_mmi_state;
+static view_t s_view = VIEW_DETAIL;
+
+/* render thread */
+static pthread_t s_render_thread;
+static int s_render_thread_stop;
+static pthread_mutex_t s_render_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_render_cond = PTHREAD_COND_INITIALIZER;
+static int s_init_result;
+static long long s_frame_period;
+
+/* offscreen rendering and snapshots */
+static config_t *s_config;
+static volatile sig_atomic_t s_snapshot_requested;
+static volatile sig_atomic_t s_benchmark_requested;
+static int s_num_snapshots;
+static FILE *s_frame_log;
+static unsigned long s_num_frames;
+
+/* state the current frame is drawn from */
+static mmi_state_t s_state;
+static seq_snapshot_t s_snapshot;
+static long long s_frame_time;
+
+/* what is currently shown on screen */
+static view_t s_shown_view;
+static sequence_t *s_shown_sequence;
+static line_t *s_shown_line;
+static char s_fields[FIELD_LAST][FIELD_LEN];
+static step_cell_t s_step_cells[NUM_LINES][NUM_STEPS];
+static param_cell_t s_param_cells[NUM_LINE_PARAMS];
+static overview_row_t s_overview_rows[NUM_SEQUENCES][NUM_LINES];
+
+/* cells changed in the current frame */
+static int s_num_cells;
+
+/* drawing batched until the end of the frame */
+static fill_t s_fills[MAX_FILLS];
+static int s_num_fills;
+static SDL_Rect s_fill_rects[MAX_FILLS];
+static marker_t s_markers[MAX_MARKERS];
+static int s_num_markers;
+static label_ref_t s_label_refs[MAX_LABELS];
+static int s_num_label_refs;
+
+/* rendered step and parameter labels */
+static label_cache_t s_labels;
+
+/* performance hud */
+static int s_hud;
+static long long s_hud_time;
+static char s_hud_lines[HUD_LINES][HUD_LINE_LEN];
+static mout_stats_t s_hud_mout;
 
-static void init_colors();
-static Uint32 get_color(color_t color);
-static Uint32 get_rgba(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
+/* frame statistics */
+static lat_hist_t s_frame_times;
+static lat_hist_t s_frame_cpu_times;
+static unsigned long s_cells_drawn;
+
+static void *render_thread(void *data);
+static int init_video(void);
+static void shutdown_video(void);
+static int create_renderer(void);
+static int create_canvas(int width, int height);
+static int handle_events(void);
+static void compute_layout(int width, int height);
+static void resize(int width, int height);
+static int wait_for_dirty(int timeout);
+static void snapshot_signal(int sig);
+static void benchmark_signal(int sig);
+static void save_snapshot(void);
+static SDL_Color get_color(color_t color);
+static void set_color(color_t color);
+static void fill_rect(int x, int y, int w, int h, color_t color);
+static void draw_text(int x, int y, const char *str, color_t color);
 static void clear_screen();
 static void draw_screen();
+static void present(void);
 static void draw_header(int ox, int oy);
+static void draw_field(field_t field, const char *str);
 static void draw_sequence(int ox, int oy, sequence_t *sequence);
-static void draw_line(int ox, int oy, line_t *line);
-static void draw_step(int ox, int oy, line_t *line, int step);
+static void draw_line(int ox, int oy, line_t *line, int index);
+static void draw_step(int ox, int oy, line_t *line, int step, int cur_step, int playhead);
+static int get_playhead(int sequence, int index, int width);
 static void draw_line_params(int ox, int oy, line_t *line);
+static void draw_overview(int ox, int oy);
+static void draw_hud(void);
+static void update_hud(void);
+static void draw_overview_row(int ox, int oy, int sequence, int index);
+static void begin_cell(int x, int y, int w, int h);
+static void end_cell(void);
+static void queue_fill(layer_t layer, color_t color, int x, int y, int w, int h);
+static void queue_outline(int x, int y, int w, int h, color_t color);
+static void queue_marker(int x1, int y1, int x2, int y2, int x3, int y3);
+static void queue_label(int x, int y, int width, param_t *param, int named);
+static void flush_batch(void);
+static void log_frame_stats(void);
+static void benchmark_draw(void);
+static void time_full_frames(int frames, long long *time, long long *cpu_time);
+static long long get_cpu_time(void);
 static void format_pulse(int pulse, char *str, int len);
 static void format_time(mio_timestamp_t time, char *str, int len);
 
@@ -81,189 +303,698 @@ static void format_time(mio_timestamp_t time, char *str, int len);
  */
 int scr_init(void)
 {
-	const SDL_VideoInfo *info;
-	Uint8  video_bpp;
-	Uint32 videoflags;
+	struct sigaction action;
+	int result;
 	
+	s_config = core_get_config();
 	s_pattern = seq_get_pattern();
-	s_mmi_state = mmi_get_state();
+	s_frame_period = s_config->frame_rate > 0 ? 1000000 / s_config->frame_rate : 0;
+	
+	/* per frame render times */
+	if (s_config->frame_log[0]) {
+		s_frame_log = fopen(s_config->frame_log, "w");
+		if (!s_frame_log)
+			LOG(LOG_WARNING, "cannot open frame log '%s'", s_config->frame_log);
+		else
+			fprintf(s_frame_log, "frame time_us cpu_us cells\n");
+	}
+	
+	/* snapshots can be requested from outside, which is the only way without a window */
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = snapshot_signal;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &action, NULL);
+	action.sa_handler = benchmark_signal;
+	sigaction(SIGUSR2, &action, NULL);
+	
+	/* the render thread owns the video subsystem, it sets up the window itself */
+	s_init_result = 1;
+	s_render_thread_stop = 0;
+	if (pthread_create(&s_render_thread, NULL, render_thread, NULL)) {
+		LOG(LOG_ERROR, "cannot create render thread");
+		return -1;
+	}
+	
+	pthread_mutex_lock(&s_render_mutex);
+	while (s_init_result > 0)
+		pthread_cond_wait(&s_render_cond, &s_render_mutex);
+	result = s_init_result;
+	pthread_mutex_unlock(&s_render_mutex);
+	
+	if (result != 0) {
+		pthread_join(s_render_thread, NULL);
+		return -1;
+	}
+	
+	return 0;
+}
+
+/*
+ * Shuts the screen down.
+ */
+void scr_shutdown(void)
+{
+	pthread_mutex_lock(&s_render_mutex);
+	s_render_thread_stop = 1;
+	pthread_cond_signal(&s_render_cond);
+	pthread_mutex_unlock(&s_render_mutex);
+	
+	pthread_join(s_render_thread, NULL);
+	
+	if (s_frame_log) {
+		fclose(s_frame_log);
+		s_frame_log = NULL;
+	}
+}
+
+/*
+ * Sets the dirty flag.
+ */
+void scr_dirty(void)
+{
+	pthread_mutex_lock(&s_render_mutex);
+	s_dirty = 1;
+	pthread_cond_signal(&s_render_cond);
+	pthread_mutex_unlock(&s_render_mutex);
+}
+
+/*
+ * Requests a snapshot of the screen.
+ */
+void scr_snapshot(void)
+{
+	s_snapshot_requested = 1;
+	scr_dirty();
+}
 
+/**
+ * Render thread. Draws a frame whenever the screen is dirty, but at most
+ * once per frame period.
+ */
+static void *render_thread(void *data)
+{
+	long long now, frame_start, next_frame = 0;
+	int result, dirty, playing = 0;
+	
+	result = init_video();
+	
+	pthread_mutex_lock(&s_render_mutex);
+	s_init_result = result;
+	pthread_cond_broadcast(&s_render_cond);
+	pthread_mutex_unlock(&s_render_mutex);
+	
+	if (result != 0)
+		return NULL;
+	
+	while (!s_render_thread_stop) {
+		/* while playing the playhead moves on every frame */
+		dirty = wait_for_dirty(playing ? 0 : EVENT_TIMEOUT);
+		dirty |= playing || seq_get_run_state() == SEQ_RUNNING;
+		dirty |= handle_events();
+		dirty |= s_snapshot_requested;
+		dirty |= s_benchmark_requested;
+		dirty |= s_hud && lat_now() - s_hud_time >= HUD_INTERVAL;
+		if (!dirty)
+			continue;
+		
+		/* changes made while waiting for the frame go into this frame */
+		now = lat_now();
+		if (now < next_frame)
+			usleep(next_frame - now);
+		wait_for_dirty(0);
+		
+		frame_start = lat_now();
+		mmi_copy_state(&s_state);
+		seq_get_snapshot(&s_snapshot);
+		draw_screen();
+		
+		if (s_snapshot_requested) {
+			s_snapshot_requested = 0;
+			save_snapshot();
+		}
+		
+		if (s_benchmark_requested) {
+			s_benchmark_requested = 0;
+			benchmark_draw();
+		}
+		
+		/* a flip blocking on vsync already used up part of the period */
+		playing = s_snapshot.run_state == SEQ_RUNNING;
+		next_frame = frame_start + s_frame_period;
+		if (playing && !s_frame_period)
+			next_frame = frame_start + PLAYING_FRAME_PERIOD;
+	}
+	
+	shutdown_video();
+	
+	return NULL;
+}
+
+/**
+ * Initializes SDL, opens the window and creates the renderer.
+ * @return Returns 0 if successful.
+ */
+static int init_video(void)
+{
+	int width, height;
+	int result = -1;
+	
+	/* the dummy driver renders into a memory surface */
+	if (s_config->headless) {
+		setenv("SDL_VIDEODRIVER", "dummy", 1);
+		LOG(LOG_INFO, "rendering offscreen");
+	}
+	
 	/* initialize SDL */
 	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
 		LOG(LOG_ERROR, "couldn't initialize SDL: %s", SDL_GetError());
 		return -1;
 	}
-	atexit(SDL_Quit);
+	
+	/* open window */
+	width = s_config->window_width > MIN_WIDTH ? s_config->window_width : MIN_WIDTH;
+	height = s_config->window_height > MIN_HEIGHT ? s_config->window_height : MIN_HEIGHT;
+	s_window = SDL_CreateWindow(WINDOW_TITLE, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+		width, height, SDL_WINDOW_RESIZABLE);
+	if (!s_window) {
+		LOG(LOG_ERROR, "couldn't open %ix%i window: %s", width, height, SDL_GetError());
+		goto out;
+	}
+	SDL_SetWindowMinimumSize(s_window, MIN_WIDTH, MIN_HEIGHT);
+	
+	if (create_renderer() != 0)
+		goto out;
+	
+	if (label_cache_init(&s_labels, s_renderer, get_color(COLOR_WHITE)) != 0)
+		goto out;
+	
+	SDL_GetRendererOutputSize(s_renderer, &width, &height);
+	if (create_canvas(width, height) != 0)
+		goto out;
+	
+	result = 0;
+	
+out:
+	if (result != 0)
+		shutdown_video();
+	
+	return result;
+}
 
-	/* alpha blending doesn't work well at 8-bit color */
-	info = SDL_GetVideoInfo();
-	if (info->vfmt->BitsPerPixel > 8) {
-		video_bpp = info->vfmt->BitsPerPixel;
-	} else {
-		video_bpp = 16;
+/**
+ * Destroys the canvas, renderer and window and shuts SDL down.
+ */
+static void shutdown_video(void)
+{
+	label_cache_free(&s_labels);
+	
+	if (s_canvas) {
+		SDL_DestroyTexture(s_canvas);
+		s_canvas = NULL;
 	}
-	videoflags = /*SDL_SWSURFACE | SDL_SRCALPHA |*/ SDL_RESIZABLE;
-	videoflags |= SDL_HWSURFACE;
-	videoflags |= SDL_HWPALETTE;
-//	videoflags |= SDL_FULLSCREEN;
+	if (s_renderer) {
+		SDL_DestroyRenderer(s_renderer);
+		s_renderer = NULL;
+	}
+	if (s_window) {
+		SDL_DestroyWindow(s_window);
+		s_window = NULL;
+	}
+	
+	SDL_Quit();
+}
 
-	/* set video mode */
-	if ((s_screen = SDL_SetVideoMode(WIDTH, HEIGHT, video_bpp, videoflags)) == NULL) {
-		LOG(LOG_ERROR, "couldn't set %ix%i video mode: %s", WIDTH, HEIGHT, SDL_GetError());
+/**
+ * Creates the renderer selected in the configuration. The accelerated
+ * renderer falls back to the software renderer if there is no gpu, which
+ * is also used offscreen.
+ * @return Returns 0 if successful.
+ */
+static int create_renderer(void)
+{
+	SDL_RendererInfo info;
+	int software = 0;
+	
+	if (s_config->headless || strcmp(s_config->renderer, "software") == 0)
+		software = 1;
+	else if (strcmp(s_config->renderer, "accelerated") != 0)
+		LOG(LOG_WARNING, "unknown renderer '%s', using accelerated", s_config->renderer);
+	
+	/* consecutive fills and copies from the label atlas go into one draw call */
+	SDL_SetHint(SDL_HINT_RENDER_BATCHING, "1");
+	
+	if (!software) {
+		s_renderer = SDL_CreateRenderer(s_window, -1,
+			SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_TARGETTEXTURE);
+		if (!s_renderer)
+			LOG(LOG_WARNING, "no accelerated renderer, using software: %s", SDL_GetError());
+	}
+	if (!s_renderer)
+		s_renderer = SDL_CreateRenderer(s_window, -1, SDL_RENDERER_SOFTWARE | SDL_RENDERER_TARGETTEXTURE);
+	if (!s_renderer) {
+		LOG(LOG_ERROR, "couldn't create renderer: %s", SDL_GetError());
 		return -1;
 	}
 	
-	/* use alpha blending */
-	//SDL_SetAlpha(s_screen, SDL_SRCALPHA, 0);
+	SDL_GetRendererInfo(s_renderer, &info);
+	s_renderer_name = info.name;
+	LOG(LOG_INFO, "using %s renderer", s_renderer_name);
 	
-	/* set title for window */
- 	SDL_WM_SetCaption(WINDOW_TITLE, WINDOW_TITLE);
- 	
- 	/* init colors */
- 	init_colors();
-
 	return 0;
 }
 
-/*
- * Shuts the screen down.
+/**
+ * Creates the canvas texture the screen is drawn to and computes the layout
+ * for its size. The canvas keeps the cells between frames, so that only the
+ * changed cells need to be drawn.
+ * @param width Width
+ * @param height Height
+ * @return Returns 0 if successful.
  */
-void scr_shutdown(void)
+static int create_canvas(int width, int height)
 {
+	SDL_Texture *canvas;
+	
+	canvas = SDL_CreateTexture(s_renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, width, height);
+	if (!canvas) {
+		LOG(LOG_ERROR, "couldn't create %ix%i canvas: %s", width, height, SDL_GetError());
+		return -1;
+	}
+	
+	SDL_SetRenderTarget(s_renderer, canvas);
+	if (s_canvas)
+		SDL_DestroyTexture(s_canvas);
+	s_canvas = canvas;
+	
+	compute_layout(width, height);
+	s_full_redraw = 1;
+	
+	return 0;
 }
 
-/*
- * Updates the screen.
+/**
+ * Handles pending window events.
+ * @return Returns 1 if the screen needs to be redrawn.
  */
-void scr_update(void)
+static int handle_events(void)
 {
 	SDL_Event event;
+	int dirty = 0;
+	int width = 0, height = 0;
 	
 	while (SDL_PollEvent(&event)) {
 		switch (event.type) {
 		case SDL_QUIT:
 			core_exit();
 			break;
+		case SDL_KEYDOWN:
+			if (event.key.keysym.sym == SDLK_l)
+				mmi_learn();
+			else if (event.key.keysym.sym == SDLK_r)
+				mio_request_rescan();
+			else if (event.key.keysym.sym == SDLK_i) {
+				mmi_log_latency();
+				log_frame_stats();
+			} else if (event.key.keysym.sym == SDLK_b)
+				benchmark_draw();
+			else if (event.key.keysym.sym == SDLK_s)
+				s_snapshot_requested = 1;
+			else if (event.key.keysym.sym == SDLK_h) {
+				/* hiding the hud uncovers the cells below */
+				s_hud = !s_hud;
+				s_hud_time = 0;
+				s_full_redraw |= !s_hud;
+				dirty = 1;
+			} else if (event.key.keysym.sym == SDLK_o) {
+				s_view = s_view == VIEW_DETAIL ? VIEW_OVERVIEW : VIEW_DETAIL;
+				dirty = 1;
+			}
+			break;
+		case SDL_WINDOWEVENT:
+			if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+				/* only the last of a series of resizes is applied */
+				width = event.window.data1;
+				height = event.window.data2;
+			} else if (event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+				s_full_redraw = 1;
+				dirty = 1;
+			}
+			break;
 		}
 	}
 	
-	if (s_dirty) {
-		draw_screen();
-		s_dirty = 0;
+	if (width && height) {
+		resize(width, height);
+		dirty = 1;
 	}
+	
+	return dirty;
 }
 
-/*
- * Sets the dirty flag.
+/**
+ * Computes the cell geometry for a window size. The steps share the width,
+ * the header, the lines and the parameter row share the height. Text keeps
+ * the size of the font.
+ * @param width Window width
+ * @param height Window height
  */
-void scr_dirty(void)
+static void compute_layout(int width, int height)
 {
-	s_dirty = 1;
+	/* widths of the header text fields from tempo to rec, learn takes the rest */
+	static const int field_widths[FIELD_LEARN - FIELD_TEMPO] = { 50, 100, 100, 60, 100 };
+	layout_t *layout = &s_layout;
+	int i;
+	
+	layout->width = width;
+	layout->height = height;
+	layout->line_height = height / (NUM_LINES + 2);
+	layout->header_height = layout->line_height;
+	layout->step_width = width / NUM_STEPS;
+	layout->step_border = layout->line_height / 5;
+	layout->param_height = layout->line_height * 2 / 5;
+	layout->overview_row_height = (height - layout->header_height) / OVERVIEW_ROWS;
+	
+	layout->field_x[FIELD_RUN_STATE] = 0;
+	layout->field_x[FIELD_TEMPO] = layout->header_height / 2 + 20;
+	for (i = FIELD_TEMPO; i < FIELD_LEARN; i++)
+		layout->field_x[i + 1] = layout->field_x[i] + field_widths[i - FIELD_TEMPO];
+	layout->field_x[FIELD_LAST] = width - 1;
+	
+	/* fields that don't fit into a narrow window are empty */
+	for (i = FIELD_TEMPO; i < FIELD_LAST; i++)
+		if (layout->field_x[i] > width - 1)
+			layout->field_x[i] = width - 1;
+	
+	layout->hud_x = width > HUD_WIDTH + 10 ? width - HUD_WIDTH - 10 : 0;
+	layout->hud_y = layout->header_height + 10;
 }
 
 /**
- * Inits the colors.
+ * Recreates the canvas for a new window size.
+ * @param width Window width
+ * @param height Window height
  */
-static void init_colors()
+static void resize(int width, int height)
 {
-	int i;
-	color_entry_t *entry;
+	width = width > MIN_WIDTH ? width : MIN_WIDTH;
+	height = height > MIN_HEIGHT ? height : MIN_HEIGHT;
+	if (width == s_layout.width && height == s_layout.height)
+		return;
+	
+	/* the old canvas is kept if there is no memory for the new one */
+	create_canvas(width, height);
+}
+
+/**
+ * Requests a snapshot on SIGUSR1.
+ * @param sig Signal number
+ */
+static void snapshot_signal(int sig)
+{
+	s_snapshot_requested = 1;
+}
+
+/**
+ * Requests a benchmark on SIGUSR2.
+ * @param sig Signal number
+ */
+static void benchmark_signal(int sig)
+{
+	s_benchmark_requested = 1;
+}
+
+/**
+ * Saves the screen to the next numbered snapshot file.
+ */
+static void save_snapshot(void)
+{
+	char filename[256];
+	SDL_Surface *surface;
 	
-	for (i = 0; i < COLOR_LAST; i++) {
-		entry = &s_color_table[i];
-		entry->sdl_color = get_rgba(entry->r, entry->g, entry->b, entry->a);
+	snprintf(filename, sizeof(filename), s_config->snapshot_file, ++s_num_snapshots);
+	
+	/* the canvas is the current render target */
+	surface = SDL_CreateRGBSurfaceWithFormat(0, s_layout.width, s_layout.height, 32, SDL_PIXELFORMAT_ARGB8888);
+	if (!surface) {
+		LOG(LOG_ERROR, "cannot save snapshot '%s': %s", filename, SDL_GetError());
+		return;
 	}
+	
+	if (SDL_RenderReadPixels(s_renderer, NULL, SDL_PIXELFORMAT_ARGB8888, surface->pixels, surface->pitch) != 0 ||
+		SDL_SaveBMP(surface, filename) != 0)
+		LOG(LOG_ERROR, "cannot save snapshot '%s': %s", filename, SDL_GetError());
+	else
+		LOG(LOG_INFO, "saved snapshot '%s'", filename);
+	
+	SDL_FreeSurface(surface);
+}
+
+/**
+ * Waits until the screen is dirty or the timeout expired and clears the
+ * dirty flag.
+ * @param timeout Timeout in ms
+ * @return Returns 1 if the screen was dirty.
+ */
+static int wait_for_dirty(int timeout)
+{
+	struct timespec deadline;
+	int dirty;
+	
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += timeout * 1000000L;
+	deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+	deadline.tv_nsec %= 1000000000L;
+	
+	pthread_mutex_lock(&s_render_mutex);
+	while (!s_dirty && !s_render_thread_stop && timeout > 0)
+		if (pthread_cond_timedwait(&s_render_cond, &s_render_mutex, &deadline) == ETIMEDOUT)
+			break;
+	dirty = s_dirty;
+	s_dirty = 0;
+	pthread_mutex_unlock(&s_render_mutex);
+	
+	return dirty;
 }
 
 /**
  * Returns a color value.
  * @return Returns color value.
  */
-static Uint32 get_color(color_t color)
+static SDL_Color get_color(color_t color)
 {
-	return s_color_table[color].sdl_color;
+	color_entry_t *entry = &s_color_table[color];
+	SDL_Color sdl_color;
+	
+	sdl_color.r = entry->r;
+	sdl_color.g = entry->g;
+	sdl_color.b = entry->b;
+	sdl_color.a = entry->a;
+	
+	return sdl_color;
 }
 
 /**
- * Returns a color from r, g, b, a values.
+ * Sets the draw color of the renderer.
  */
-static Uint32 get_rgba(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+static void set_color(color_t color)
 {
-	return r << 24 | g << 16 | b << 8 | a;
+	color_entry_t *entry = &s_color_table[color];
+	
+	SDL_SetRenderDrawColor(s_renderer, entry->r, entry->g, entry->b, entry->a);
 }
 
 /**
- * Clears the screen.
+ * Fills a rectangle right away.
+ * @param x Position x
+ * @param y Position y
+ * @param w Width
+ * @param h Height
+ * @param color Color
  */
-static void clear_screen()
+static void fill_rect(int x, int y, int w, int h, color_t color)
 {
-	SDL_Rect clip;
+	SDL_Rect rect;
+	
+	rect.x = x;
+	rect.y = y;
+	rect.w = w;
+	rect.h = h;
+	
+	set_color(color);
+	SDL_RenderFillRect(s_renderer, &rect);
+}
 
-	clip.x = 0;
-	clip.y = 0;
-	clip.w = WIDTH;
-	clip.h = HEIGHT;
+/**
+ * Draws a text right away.
+ * @param x Position x
+ * @param y Position y
+ * @param str Text
+ * @param color Color
+ */
+static void draw_text(int x, int y, const char *str, color_t color)
+{
+	color_entry_t *entry = &s_color_table[color];
 	
-	SDL_SetClipRect(s_screen, &clip);
-	SDL_FillRect(s_screen, NULL, get_color(COLOR_BLACK));
+	stringRGBA(s_renderer, x, y, str, entry->r, entry->g, entry->b, entry->a);
 }
 
 /**
- * Draws the screen.
+ * Clears the screen.
  */
-static void draw_screen()
+static void clear_screen()
 {
-	clear_screen();
+	SDL_RenderSetClipRect(s_renderer, NULL);
+	set_color(COLOR_BLACK);
+	SDL_RenderClear(s_renderer);
+}
 
-	draw_header(0, 0);	
-	draw_sequence(0, HEADER_HEIGHT, s_mmi_state->sequence);
+/**
+ * Draws the screen. Only cells whose contents have changed since the last
+ * frame are redrawn into the canvas, unless the layout has changed. The
+ * fills of the cells are batched by layer and color, followed by the
+ * markers and the labels.
+ */
+static void draw_screen()
+{
+	long long start = lat_now();
+	long long cpu_start = get_cpu_time();
+	long long time, cpu_time;
+	
+	s_frame_time = start;
+	if (s_state.sequence == NULL)
+		return;
+	
+	/* selecting another line moves the parameter row of the detail view */
+	if (s_view != s_shown_view ||
+		(s_view == VIEW_DETAIL && (s_state.sequence != s_shown_sequence || s_state.line != s_shown_line)))
+		s_full_redraw = 1;
 	
-	SDL_Flip(s_screen);
+	s_num_cells = 0;
+	
+	if (s_full_redraw) {
+		clear_screen();
+		memset(s_fields, 0xff, sizeof(s_fields));
+		memset(s_step_cells, 0xff, sizeof(s_step_cells));
+		memset(s_param_cells, 0xff, sizeof(s_param_cells));
+		memset(s_overview_rows, 0xff, sizeof(s_overview_rows));
+		s_shown_view = s_view;
+		s_shown_sequence = s_state.sequence;
+		s_shown_line = s_state.line;
+		
+		fill_rect(0, 0, s_layout.width, s_layout.header_height + 1, COLOR_HEADER);
+		queue_outline(0, 0, s_layout.width + 1, s_layout.header_height + 1, COLOR_WHITE);
+	}
+	
+	draw_header(0, 0);
+	if (s_view == VIEW_OVERVIEW)
+		draw_overview(0, s_layout.header_height);
+	else
+		draw_sequence(0, s_layout.header_height, s_state.sequence);
+	flush_batch();
+	if (s_hud)
+		draw_hud();
+	
+	if (s_full_redraw || s_num_cells > 0)
+		present();
+	
+	s_cells_drawn += s_num_cells;
+	s_full_redraw = 0;
+	
+	time = lat_now() - start;
+	cpu_time = get_cpu_time() - cpu_start;
+	lat_add(&s_frame_times, time);
+	lat_add(&s_frame_cpu_times, cpu_time);
+	
+	s_num_frames++;
+	if (s_frame_log)
+		fprintf(s_frame_log, "%lu %lld %lld %d\n", s_num_frames, time, cpu_time, s_num_cells);
 }
 
 /**
- * Draws the header.
+ * Copies the canvas to the window and presents it.
+ */
+static void present(void)
+{
+	SDL_SetRenderTarget(s_renderer, NULL);
+	SDL_RenderCopy(s_renderer, s_canvas, NULL, NULL);
+	SDL_RenderPresent(s_renderer);
+	SDL_SetRenderTarget(s_renderer, s_canvas);
+}
+
+/**
+ * Draws the changed header fields.
  */
 static void draw_header(int ox, int oy)
 {
+	char str[FIELD_LEN];
 	int x, y;
 	int size;
-	char str[128];
-
-	boxColor(s_screen, ox, oy, ox + WIDTH, oy + HEADER_HEIGHT, get_color(COLOR_HEADER));
-	rectangleColor(s_screen, ox, oy, ox + WIDTH, oy + HEADER_HEIGHT, get_color(COLOR_WHITE));
 	
-	x = ox + HEADER_HEIGHT / 2;
-	y = oy + HEADER_HEIGHT / 2;
-	size = 10;
-	
-	switch (seq_get_run_state()) {
-	case SEQ_RUNNING:
-		filledTrigonColor(s_screen, x - size, y - size, x - size, y + size, x + size, y, get_color(COLOR_WHITE));
-		break;
-	case SEQ_STOPPED:
-		boxColor(s_screen, x - size, y - size, x + size, y + size, get_color(COLOR_WHITE));
-		break;
+	/* run state is shown as a symbol */
+	snprintf(str, sizeof(str), "%d", s_snapshot.run_state);
+	if (strcmp(str, s_fields[FIELD_RUN_STATE]) != 0) {
+		strcpy(s_fields[FIELD_RUN_STATE], str);
+		begin_cell(ox + 1, oy + 1, s_layout.field_x[FIELD_TEMPO] - 1, s_layout.header_height - 1);
+		fill_rect(ox + 1, oy + 1, s_layout.field_x[FIELD_TEMPO] - 1, s_layout.header_height - 1, COLOR_HEADER);
+		
+		x = ox + s_layout.header_height / 2;
+		y = oy + s_layout.header_height / 2;
+		size = s_layout.header_height / 5;
+		
+		switch (s_snapshot.run_state) {
+		case SEQ_RUNNING:
+			filledTrigonRGBA(s_renderer, x - size, y - size, x - size, y + size, x + size, y, 255, 255, 255, 255);
+			break;
+		case SEQ_STOPPED:
+			fill_rect(x - size, y - size, 2 * size + 1, 2 * size + 1, COLOR_WHITE);
+			break;
+		}
+		end_cell();
 	}
 	
-	y -= 4;
+	snprintf(str, sizeof(str), "%d", (int) s_snapshot.bpm);
+	draw_field(FIELD_TEMPO, str);
 	
-	x += size * 2;
-	param_get_str(&s_pattern->tempo, str, sizeof(str));
-	stringColor(s_screen, x, y, str, get_color(COLOR_WHITE));
+	format_pulse(s_snapshot.pulse, str, sizeof(str));
+	draw_field(FIELD_PULSE, str);
 	
-	x += 50;
-	format_pulse(seq_get_pulse(), str, sizeof(str));
-	stringColor(s_screen, x, y, str, get_color(COLOR_WHITE));
+	format_time(s_snapshot.elapsed_time, str, sizeof(str));
+	draw_field(FIELD_TIME, str);
+	
+	snprintf(str, sizeof(str), "S%d-L%d", s_state.sequence_index + 1, s_state.line_index + 1);
+	draw_field(FIELD_POSITION, str);
+	
+	str[0] = 0;
+	if (rec_get_mode() != REC_OFF)
+		snprintf(str, sizeof(str), "REC %s", rec_get_mode_name(rec_get_mode()));
+	draw_field(FIELD_REC, str);
+	
+	str[0] = 0;
+	if (s_state.learn)
+		snprintf(str, sizeof(str), "LEARN %s %d", ccmap_get_action_name(s_state.learn_action), s_state.learn_arg + 1);
+	draw_field(FIELD_LEARN, str);
+}
+
+/**
+ * Draws a header text field if its text has changed.
+ * @param field Header field
+ * @param str Text
+ */
+static void draw_field(field_t field, const char *str)
+{
+	int x = s_layout.field_x[field];
+	int w = s_layout.field_x[field + 1] - x;
 	
-	x += 100;
-	format_time(seq_get_elapsed_time(), str, sizeof(str));
-	stringColor(s_screen, x, y, str, get_color(COLOR_WHITE));
+	if (strcmp(str, s_fields[field]) == 0)
+		return;
 	
-	x += 100;
-	snprintf(str, sizeof(str), "S%d-L%d", s_mmi_state->sequence_index + 1, s_mmi_state->line_index + 1);
-	stringColor(s_screen, x, y, str, get_color(COLOR_WHITE));
+	snprintf(s_fields[field], FIELD_LEN, "%s", str);
 	
+	begin_cell(x, 1, w, s_layout.header_height - 1);
+	fill_rect(x, 1, w, s_layout.header_height - 1, COLOR_HEADER);
+	draw_text(x, s_layout.header_height / 2 - 4, str, COLOR_WHITE);
+	end_cell();
 }
 
 /**
@@ -279,36 +1010,61 @@ static void draw_sequence(int ox, int oy, sequence_t *sequence)
 
 	for (i = 0; i < NUM_LINES; i++) {
 		line = &sequence->lines[i];
-		draw_line(ox, oy, line);
-		oy += LINE_HEIGHT;
-		if (line == s_mmi_state->line) {
+		draw_line(ox, oy, line, i);
+		oy += s_layout.line_height;
+		if (line == s_state.line) {
 			draw_line_params(ox, oy, line);
-			oy += LINE_HEIGHT;
+			oy += s_layout.line_height;
 		}
 	}
 }
 
 /**
- * Draws a single sequencer line.
+ * Draws the changed steps of a sequencer line.
  * @param ox Origin x
  * @param oy Origin y
  * @param line Line
+ * @param index Line index
  */
-static void draw_line(int ox, int oy, line_t *line)
+static void draw_line(int ox, int oy, line_t *line, int index)
 {
-	Uint32 color;
-	int step;
+	step_cell_t cell, *shown;
+	color_t color;
+	int first, last;
+	int cur_step;
+	int step, x;
 	
-	if (line == s_mmi_state->line)
-		color = get_rgba(0, 0, 150, 255);
+	if (line == s_state.line)
+		color = COLOR_LINE_SELECTED;
 	else
-		color = get_rgba(0, 0, 50, 255);
+		color = COLOR_LINE;
 	
-	boxColor(s_screen, ox, oy, ox + WIDTH, oy + LINE_HEIGHT, color);
-	rectangleColor(s_screen, ox, oy, ox + WIDTH, oy + LINE_HEIGHT, get_color(COLOR_WHITE));
+	first = param_get(&line->first_step);
+	last = param_get(&line->last_step);
+	cur_step = s_snapshot.cur_steps[s_state.sequence_index][index];
 	
 	for (step = 0; step < NUM_STEPS; step++) {
-		draw_step(ox + step * STEP_WIDTH, oy, line, step);
+		cell.mode = param_get(&line->step_modes[step]);
+		cell.value = param_get(&line->step_values[step]);
+		cell.class = line->step_values[step].class_def->class;
+		cell.flags = (step == cur_step ? STEP_ACTIVE : 0) |
+			(step == first ? STEP_FIRST : 0) |
+			(step == last ? STEP_LAST : 0);
+		cell.playhead = step == cur_step ? get_playhead(s_state.sequence_index, index, s_layout.step_width) : -1;
+		
+		shown = &s_step_cells[index][step];
+		if (memcmp(&cell, shown, sizeof(cell)) == 0)
+			continue;
+		*shown = cell;
+		
+		/* the cell includes its part of the line background and border */
+		x = ox + step * s_layout.step_width;
+		s_num_cells++;
+		queue_fill(LAYER_BACKGROUND, color, x, oy, s_layout.step_width, s_layout.line_height);
+		queue_fill(LAYER_BORDER, COLOR_WHITE, x, oy, s_layout.step_width, 1);
+		if (step == 0)
+			queue_fill(LAYER_BORDER, COLOR_WHITE, x, oy, 1, s_layout.line_height);
+		draw_step(x, oy, line, step, cur_step, cell.playhead);
 	}
 }
 
@@ -318,42 +1074,76 @@ static void draw_line(int ox, int oy, line_t *line)
  * @param oy Origin y
  * @param line Line
  * @param step Step number
+ * @param cur_step Current step of the line
+ * @param playhead Width of the playhead bar, -1 if not shown
  */
-static void draw_step(int ox, int oy, line_t *line, int step)
+static void draw_step(int ox, int oy, line_t *line, int step, int cur_step, int playhead)
 {
-	char str[128];
 	int first, last;
 	int step_mode;
-	Uint32 color;
+	color_t color = COLOR_STEP_OFF;
 	
 	first = param_get(&line->first_step);
 	last = param_get(&line->last_step);
 	
 	step_mode = param_get(&line->step_modes[step]);
 	switch (step_mode) {
-	case STEP_MODE_OFF: color = get_color(COLOR_STEP_OFF); break;
-	case STEP_MODE_ON: color = get_color(COLOR_STEP_ON); break;
-	case STEP_MODE_SKIP: color = get_color(COLOR_STEP_SKIP); break;
+	case STEP_MODE_OFF: color = COLOR_STEP_OFF; break;
+	case STEP_MODE_ON: color = COLOR_STEP_ON; break;
+	case STEP_MODE_SKIP: color = COLOR_STEP_SKIP; break;
 	}
 
-	if (step == line->cur_step)
-		color = get_color(COLOR_STEP_ACTIVE);
+	if (step == cur_step)
+		color = COLOR_STEP_ACTIVE;
 	
-//	if (step == s_mmi_state->last_edited_step)
+//	if (step == s_state.last_edited_step)
 //		color = get_rgba(255, 255, 255, 255);
 	
-	boxColor(s_screen, ox, oy, ox + STEP_WIDTH, oy + STEP_BORDER, color);
-	rectangleColor(s_screen, ox, oy, ox + STEP_WIDTH, oy + STEP_BORDER, get_color(COLOR_WHITE));
+	queue_fill(LAYER_STEP, color, ox, oy, s_layout.step_width, s_layout.step_border + 1);
+	queue_outline(ox, oy, s_layout.step_width, s_layout.step_border + 1, COLOR_WHITE);
 	
 	if (step == first)
-		filledTrigonColor(s_screen, ox + 1, oy + 1, ox + 1, oy + STEP_BORDER - 1, ox + STEP_BORDER, oy + STEP_BORDER / 2, get_color(COLOR_FIRST_LAST));
+		queue_marker(ox + 1, oy + 1, ox + 1, oy + s_layout.step_border - 1, ox + s_layout.step_border, oy + s_layout.step_border / 2);
 	
 	if (step == last)
-		filledTrigonColor(s_screen, ox + STEP_WIDTH - 1, oy + 1, ox + STEP_WIDTH - 1, oy + STEP_BORDER - 1, ox + STEP_WIDTH - STEP_BORDER - 1, oy + STEP_BORDER / 2, get_color(COLOR_FIRST_LAST));
+		queue_marker(ox + s_layout.step_width - 2, oy + 1, ox + s_layout.step_width - 2, oy + s_layout.step_border - 1, ox + s_layout.step_width - s_layout.step_border - 2, oy + s_layout.step_border / 2);
 		
 	
-	param_get_str(&line->step_values[step], str, sizeof(str));
-	stringColor(s_screen, ox + 5, oy + 25, str, get_color(COLOR_WHITE));
+	if (playhead > 0)
+		queue_fill(LAYER_STEP, COLOR_STEP_ACTIVE, ox, oy + s_layout.step_border + 1, playhead, s_layout.step_border / 3 + 1);
+	
+	queue_label(ox + 5, oy + s_layout.line_height / 2, s_layout.step_width - 5, &line->step_values[step], 0);
+}
+
+/**
+ * Returns the playhead position within the current step of a line. The
+ * position is interpolated from the time since the last pulse, so that the
+ * playhead moves on every frame rather than on every pulse. It stops at the
+ * end of the step until the next step is played, which depends on the play
+ * mode.
+ * @param sequence Sequence index
+ * @param index Line index
+ * @param width Width of a step
+ * @return Returns the position in pixels, -1 if the line is not playing.
+ */
+static int get_playhead(int sequence, int index, int width)
+{
+	int gate = s_snapshot.gates[sequence][index];
+	double pulse_period, pos;
+	
+	if (s_snapshot.run_state != SEQ_RUNNING || s_snapshot.cur_steps[sequence][index] < 0 ||
+		gate <= 0 || s_snapshot.bpm <= 0)
+		return -1;
+	
+	/* pulses since the start of the step */
+	pulse_period = 60000000.0 / (s_snapshot.bpm * 24);
+	pos = s_snapshot.step_pulses[sequence][index] - 1 + (s_frame_time - s_snapshot.pulse_time) / pulse_period;
+	if (pos < 0)
+		pos = 0;
+	if (pos > gate)
+		pos = gate;
+	
+	return (int) (pos * width / gate);
 }
 
 /**
@@ -364,19 +1154,401 @@ static void draw_step(int ox, int oy, line_t *line, int step)
  */
 static void draw_line_params(int ox, int oy, line_t *line)
 {
-	char str[128];
-	char val[128];
 	int i;
-	param_t *param;
+	param_cell_t cell, *shown;
+	
+	int x, y;
 	
 	for (i = 0; i < NUM_LINE_PARAMS; i++) {
-		param = line->params[i];
-		if (param) {
-			param_get_str(param, val, sizeof(val));
-			snprintf(str, sizeof(str), "%s: %s", param_get_name(param), val);
-			stringColor(s_screen, ox + (i % 8) * (STEP_WIDTH * 4) + 5, oy + 10 + (i / 8) * 20, str, get_color(COLOR_WHITE));
+		/* slots are reassigned when the line mode changes, empty slots are cleared */
+		memset(&cell, 0, sizeof(cell));
+		cell.param = line->params[i];
+		if (cell.param) {
+			cell.class = cell.param->class_def->class;
+			cell.value = param_get(cell.param);
+		}
+		
+		shown = &s_param_cells[i];
+		if (memcmp(&cell, shown, sizeof(cell)) == 0)
+			continue;
+		*shown = cell;
+		
+		x = ox + (i % 8) * (s_layout.step_width * 4);
+		y = oy + 5 + (i / 8) * s_layout.param_height;
+		s_num_cells++;
+		queue_fill(LAYER_BACKGROUND, COLOR_BLACK, x, y, s_layout.step_width * 4, s_layout.param_height);
+		if (cell.param)
+			queue_label(x + 5, y + 5, s_layout.step_width * 4 - 5, cell.param, 1);
+	}
+}
+
+/**
+ * Draws the changed parts of the overview.
+ * @param ox Origin x
+ * @param oy Origin y
+ */
+static void draw_overview(int ox, int oy)
+{
+	int i, j;
+	
+	for (i = 0; i < NUM_SEQUENCES; i++) {
+		for (j = 0; j < NUM_LINES; j++) {
+			draw_overview_row(ox, oy, i, j);
+			oy += s_layout.overview_row_height;
+		}
+	}
+}
+
+/**
+ * Draws the changed steps of an overview row. Adjacent steps of the same
+ * color are filled at once.
+ * @param ox Origin x
+ * @param oy Origin y
+ * @param sequence Sequence index
+ * @param index Line index
+ */
+static void draw_overview_row(int ox, int oy, int sequence, int index)
+{
+	overview_row_t row, *shown = &s_overview_rows[sequence][index];
+	line_t *line = &s_pattern->sequences[sequence].lines[index];
+	int first, last, cur_step;
+	int step, start, end, run;
+	
+	first = param_get(&line->first_step);
+	last = param_get(&line->last_step);
+	cur_step = s_snapshot.cur_steps[sequence][index];
+	
+	for (step = 0; step < NUM_STEPS; step++) {
+		if (step == cur_step)
+			row.colors[step] = COLOR_STEP_ACTIVE;
+		else if (step < first || step > last)
+			row.colors[step] = COLOR_STEP_OUTSIDE;
+		else switch (param_get(&line->step_modes[step])) {
+		case STEP_MODE_ON: row.colors[step] = COLOR_STEP_ON; break;
+		case STEP_MODE_SKIP: row.colors[step] = COLOR_STEP_SKIP; break;
+		default: row.colors[step] = COLOR_STEP_OFF; break;
 		}
 	}
+	row.selected = sequence == s_state.sequence_index && index == s_state.line_index;
+	
+	/* find the changed span, moving the selection redraws the whole row */
+	if (row.selected != shown->selected) {
+		start = 0;
+		end = NUM_STEPS - 1;
+	} else {
+		for (start = 0; start < NUM_STEPS && row.colors[start] == shown->colors[start]; start++);
+		if (start == NUM_STEPS)
+			return;
+		for (end = NUM_STEPS - 1; row.colors[end] == shown->colors[end]; end--);
+	}
+	*shown = row;
+	
+	s_num_cells++;
+	for (step = start; step <= end; step += run) {
+		for (run = 1; step + run <= end && row.colors[step + run] == row.colors[step]; run++);
+		queue_fill(LAYER_STEP, row.colors[step], ox + step * s_layout.step_width, oy,
+			run * s_layout.step_width, s_layout.overview_row_height - 1);
+	}
+	if (row.selected)
+		queue_outline(ox, oy, s_layout.width, s_layout.overview_row_height - 1, COLOR_WHITE);
+}
+
+/**
+ * Draws the performance hud on top of the cells drawn in this frame. The
+ * numbers are updated every HUD_INTERVAL.
+ */
+static void draw_hud(void)
+{
+	int i;
+	
+	if (lat_now() - s_hud_time >= HUD_INTERVAL)
+		update_hud();
+	
+	begin_cell(s_layout.hud_x, s_layout.hud_y, HUD_WIDTH, HUD_HEIGHT);
+	fill_rect(s_layout.hud_x, s_layout.hud_y, HUD_WIDTH, HUD_HEIGHT, COLOR_BLACK);
+	queue_outline(s_layout.hud_x, s_layout.hud_y, HUD_WIDTH, HUD_HEIGHT, COLOR_WHITE);
+	flush_batch();
+	for (i = 0; i < HUD_LINES; i++)
+		draw_text(s_layout.hud_x + 5, s_layout.hud_y + 6 + i * 12, s_hud_lines[i], COLOR_WHITE);
+	end_cell();
+}
+
+/**
+ * Formats the performance hud from the sequencer, output and frame
+ * statistics. Event rates are taken over the time since the last update.
+ */
+static void update_hud(void)
+{
+	seq_stats_t *stats = &s_snapshot.stats;
+	mout_stats_t mout;
+	lat_stats_t frame;
+	long long now = lat_now();
+	double seconds = (now - s_hud_time) / 1000000.0;
+	int i, len;
+	
+	mout_get_stats(&mout);
+	lat_get_stats(&s_frame_times, &frame);
+	
+	snprintf(s_hud_lines[0], HUD_LINE_LEN, "pulse late us: last %ld max %ld p99 %ld",
+		stats->lateness, stats->lateness_hist.max, lat_get_percentile(&stats->lateness_hist, 99));
+	snprintf(s_hud_lines[1], HUD_LINE_LEN, "seq cpu us/pulse: last %ld max %ld p99 %ld",
+		stats->cpu_time, stats->cpu_time_hist.max, lat_get_percentile(&stats->cpu_time_hist, 99));
+	
+	len = snprintf(s_hud_lines[2], HUD_LINE_LEN, "events/s:");
+	for (i = 0; i < MOUT_MAX_STREAMS && len < HUD_LINE_LEN; i++)
+		len += snprintf(s_hud_lines[2] + len, HUD_LINE_LEN - len, " out %d %lu", i + 1,
+			s_hud_time ? (unsigned long) ((mout.events[i] - s_hud_mout.events[i]) / seconds) : 0);
+	
+	snprintf(s_hud_lines[3], HUD_LINE_LEN, "voices: %d/%d", mout.voices, mout.max_voices);
+	snprintf(s_hud_lines[4], HUD_LINE_LEN, "dropped: %lu output, %lu midi io", mout.dropped, mio_get_dropped());
+	snprintf(s_hud_lines[5], HUD_LINE_LEN, "frame us: p50 %ld p99 %ld max %ld", frame.p50, frame.p99, frame.max);
+	
+	s_hud_mout = mout;
+	s_hud_time = now;
+}
+
+/**
+ * Starts drawing a cell right away. Drawing is clipped to the cell.
+ * @param x Position x
+ * @param y Position y
+ * @param w Width
+ * @param h Height
+ */
+static void begin_cell(int x, int y, int w, int h)
+{
+	SDL_Rect rect;
+	
+	rect.x = x;
+	rect.y = y;
+	rect.w = w;
+	rect.h = h;
+	
+	s_num_cells++;
+	SDL_RenderSetClipRect(s_renderer, &rect);
+}
+
+/**
+ * Finishes drawing a cell.
+ */
+static void end_cell(void)
+{
+	SDL_RenderSetClipRect(s_renderer, NULL);
+}
+
+/**
+ * Queues a fill for the end of the frame.
+ * @param layer Layer
+ * @param color Color
+ * @param x Position x
+ * @param y Position y
+ * @param w Width
+ * @param h Height
+ */
+static void queue_fill(layer_t layer, color_t color, int x, int y, int w, int h)
+{
+	fill_t *fill;
+	
+	if (s_num_fills == MAX_FILLS)
+		flush_batch();
+	
+	fill = &s_fills[s_num_fills++];
+	fill->key = layer * COLOR_LAST + color;
+	fill->rect.x = x;
+	fill->rect.y = y;
+	fill->rect.w = w;
+	fill->rect.h = h;
+}
+
+/**
+ * Queues the one pixel outline of a rectangle as fills of the border layer.
+ * @param x Position x
+ * @param y Position y
+ * @param w Width
+ * @param h Height
+ * @param color Color
+ */
+static void queue_outline(int x, int y, int w, int h, color_t color)
+{
+	queue_fill(LAYER_BORDER, color, x, y, w, 1);
+	queue_fill(LAYER_BORDER, color, x, y + h - 1, w, 1);
+	queue_fill(LAYER_BORDER, color, x, y, 1, h);
+	queue_fill(LAYER_BORDER, color, x + w - 1, y, 1, h);
+}
+
+/**
+ * Queues a first or last step marker, which is drawn on top of the fills.
+ */
+static void queue_marker(int x1, int y1, int x2, int y2, int x3, int y3)
+{
+	marker_t *marker;
+	
+	if (s_num_markers == MAX_MARKERS)
+		flush_batch();
+	
+	marker = &s_markers[s_num_markers++];
+	marker->x[0] = x1;
+	marker->y[0] = y1;
+	marker->x[1] = x2;
+	marker->y[1] = y2;
+	marker->x[2] = x3;
+	marker->y[2] = y3;
+}
+
+/**
+ * Queues a label, which is drawn on top of the fills and markers.
+ * @param x Position x
+ * @param y Position y
+ * @param width Maximum width
+ * @param param Parameter
+ * @param named Set to prefix the label with the parameter name
+ */
+static void queue_label(int x, int y, int width, param_t *param, int named)
+{
+	label_ref_t *ref;
+	
+	if (s_num_label_refs == MAX_LABELS)
+		flush_batch();
+	
+	ref = &s_label_refs[s_num_label_refs++];
+	ref->x = x;
+	ref->y = y;
+	ref->width = width;
+	ref->param = param;
+	ref->named = named;
+}
+
+/**
+ * Draws the queued fills, markers and labels. The fills are sorted by layer
+ * and color, so that each color of a layer takes a single draw call. The
+ * labels are all copied from the label atlas, which the renderer batches
+ * into a single draw call as well.
+ */
+static void flush_batch(void)
+{
+	int start[LAYER_LAST * COLOR_LAST + 1];
+	int next[LAYER_LAST * COLOR_LAST];
+	color_entry_t *entry;
+	marker_t *marker;
+	label_ref_t *ref;
+	int i, key;
+	
+	memset(start, 0, sizeof(start));
+	for (i = 0; i < s_num_fills; i++)
+		start[s_fills[i].key + 1]++;
+	for (key = 0; key < LAYER_LAST * COLOR_LAST; key++) {
+		start[key + 1] += start[key];
+		next[key] = start[key];
+	}
+	for (i = 0; i < s_num_fills; i++)
+		s_fill_rects[next[s_fills[i].key]++] = s_fills[i].rect;
+	
+	for (key = 0; key < LAYER_LAST * COLOR_LAST; key++) {
+		if (start[key + 1] == start[key])
+			continue;
+		set_color(key % COLOR_LAST);
+		SDL_RenderFillRects(s_renderer, &s_fill_rects[start[key]], start[key + 1] - start[key]);
+	}
+	
+	entry = &s_color_table[COLOR_FIRST_LAST];
+	for (i = 0; i < s_num_markers; i++) {
+		marker = &s_markers[i];
+		filledTrigonRGBA(s_renderer, marker->x[0], marker->y[0], marker->x[1], marker->y[1],
+			marker->x[2], marker->y[2], entry->r, entry->g, entry->b, entry->a);
+	}
+	
+	for (i = 0; i < s_num_label_refs; i++) {
+		ref = &s_label_refs[i];
+		label_draw(&s_labels, ref->x, ref->y, ref->width, ref->param, ref->named);
+	}
+	
+	s_num_fills = 0;
+	s_num_markers = 0;
+	s_num_label_refs = 0;
+}
+
+/**
+ * Logs frame time and cpu time per frame.
+ */
+static void log_frame_stats(void)
+{
+	lat_stats_t time, cpu;
+	
+	lat_get_stats(&s_frame_times, &time);
+	lat_get_stats(&s_frame_cpu_times, &cpu);
+	
+	LOG(LOG_INFO, "screen (us): frame time p50 %ld p99 %ld max %ld, cpu p50 %ld p99 %ld max %ld, %.1f cells per frame (%u frames)",
+		time.p50, time.p99, time.max, cpu.p50, cpu.p99, cpu.max,
+		time.count ? (double) s_cells_drawn / time.count : 0.0, time.count);
+	LOG(LOG_INFO, "screen labels: %d cached, %lu hits, %lu misses", s_labels.count, s_labels.hits, s_labels.misses);
+}
+
+/**
+ * Measures the frame time and cpu time of drawing and presenting full
+ * frames with and without the label cache on the current renderer. With
+ * vsync the frame time includes waiting for the display. The frame
+ * statistics and frame log are left untouched.
+ */
+static void benchmark_draw(void)
+{
+	lat_hist_t frame_times = s_frame_times;
+	lat_hist_t frame_cpu_times = s_frame_cpu_times;
+	unsigned long cells_drawn = s_cells_drawn;
+	unsigned long num_frames = s_num_frames;
+	FILE *frame_log = s_frame_log;
+	long long uncached, uncached_cpu, cold, cold_cpu, cached, cached_cpu;
+	
+	s_frame_log = NULL;
+	
+	s_labels.enabled = 0;
+	time_full_frames(BENCHMARK_FRAMES, &uncached, &uncached_cpu);
+	
+	s_labels.enabled = 1;
+	label_cache_clear(&s_labels);
+	time_full_frames(1, &cold, &cold_cpu);
+	time_full_frames(BENCHMARK_FRAMES, &cached, &cached_cpu);
+	
+	LOG(LOG_INFO, "draw_screen on %s renderer (us per full frame, time/cpu): %lld/%lld without label cache, %lld/%lld with cold cache, %lld/%lld with warm cache",
+		s_renderer_name, uncached, uncached_cpu, cold, cold_cpu, cached, cached_cpu);
+	
+	s_frame_times = frame_times;
+	s_frame_cpu_times = frame_cpu_times;
+	s_cells_drawn = cells_drawn;
+	s_num_frames = num_frames;
+	s_frame_log = frame_log;
+}
+
+/**
+ * Draws and presents full frames of the current state.
+ * @param frames Number of frames
+ * @param time Returns the average time per frame in us
+ * @param cpu_time Returns the average cpu time per frame in us
+ */
+static void time_full_frames(int frames, long long *time, long long *cpu_time)
+{
+	long long start = lat_now();
+	long long cpu_start = get_cpu_time();
+	int i;
+	
+	for (i = 0; i < frames; i++) {
+		s_full_redraw = 1;
+		draw_screen();
+	}
+	
+	*time = (lat_now() - start) / frames;
+	*cpu_time = (get_cpu_time() - cpu_start) / frames;
+}
+
+/**
+ * Returns the cpu time used by the calling thread.
+ * @return Returns the cpu time in us.
+ */
+static long long get_cpu_time(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	
+	return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
 }
 
 /**
@@ -2,7 +2,14 @@
 #define __SCREEN_H__
 
 /**
- * Initializes the screen.
+ * Initializes the screen and starts the render thread, which redraws the
+ * screen from a snapshot of the playback and mmi state when it is dirty.
+ * While the sequencer is running it redraws on every frame, interpolating
+ * the playhead between pulses.
+ * The screen is drawn with the accelerated or the software renderer of
+ * SDL2, as configured. In headless mode the screen is rendered offscreen
+ * by the dummy video driver and the software renderer. A frame time
+ * benchmark is run on SIGUSR2 and the 'b' key.
  * @return Returns 0 if successful.
  */
 int scr_init(void);
@@ -13,13 +20,15 @@ int scr_init(void);
 void scr_shutdown(void);
 
 /**
- * Updates the screen.
+ * Sets the dirty flag. Can be called from any thread. Playback changes
+ * don't need to be flagged.
  */
-void scr_update(void);
+void scr_dirty(void);
 
 /**
- * Sets the dirty flag.
+ * Requests a snapshot of the screen, which is saved as a bitmap after the
+ * next frame. Snapshots are also taken on SIGUSR1 and the 's' key.
  */
-void scr_dirty(void);
+void scr_snapshot(void);
 
 #endif /*__SCREEN_H__*/
@@ -1,12 +1,20 @@
 
 #include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "log.h"
+#include "lat.h"
 #include "mio.h"
+#include "mout.h"
 #include "mmi.h"
 #include "clock.h"
 #include "pattern.h"
+#include "line.h"
+#include "rec.h"
+#include "vis.h"
 #include "seq.h"
 
 static seq_run_state_t s_run_state;
@@ -14,9 +22,20 @@ static clk_t s_clock;
 static pattern_t s_pattern;
 
 static pthread_t s_thread;
+static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
 static int s_thread_stop = 0;
+static long long *s_probes[SEQ_MAX_PROBES];
+
+/* playback state, published with a sequence lock */
+static seq_snapshot_t s_snapshot;
+static unsigned int s_snapshot_seq;
+static seq_stats_t s_stats;
+static long long s_pulse_time;
 
 static void *seq_thread(void *data);
+static void complete_probes(void);
+static void publish_snapshot(void);
+static long get_cpu_time(void);
 static void clock_cb(clk_t *clk, int beat, mio_timestamp_t timestamp);
 
 /*
@@ -37,6 +56,10 @@ int seq_init(void)
 	clk_set_bpm(&s_clock, 130, 24);
 	
 	pattern_init(&s_pattern);
+	
+	pthread_mutex_lock(&s_mutex);
+	publish_snapshot();
+	pthread_mutex_unlock(&s_mutex);
 		
 	return 0;
 }
@@ -65,7 +88,10 @@ pattern_t *seq_get_pattern(void)
  */
 void seq_set_tempo(float tempo)
 {
+	pthread_mutex_lock(&s_mutex);
 	clk_set_bpm(&s_clock, tempo, 24);
+	publish_snapshot();
+	pthread_mutex_unlock(&s_mutex);
 }
 
 /*
@@ -76,9 +102,14 @@ void seq_start(void)
 	if (s_run_state == SEQ_RUNNING)
 		seq_stop();
 
+	pthread_mutex_lock(&s_mutex);
 	pattern_reset(&s_pattern);
 	clk_start(&s_clock);
+	memset(&s_stats, 0, sizeof(s_stats));
+	s_pulse_time = lat_now();
 	s_run_state = SEQ_RUNNING;
+	publish_snapshot();
+	pthread_mutex_unlock(&s_mutex);
 }
 
 /*
@@ -89,7 +120,25 @@ void seq_stop(void)
 	if (s_run_state == SEQ_STOPPED)
 		return;
 		
+	pthread_mutex_lock(&s_mutex);
 	s_run_state = SEQ_STOPPED;
+	/* stop all sounding notes in one go, then let the lines drop their notes */
+	mout_stop_all();
+	pattern_reset(&s_pattern);
+	publish_snapshot();
+	pthread_mutex_unlock(&s_mutex);
+}
+
+/*
+ * Stops the sequencer and silences all outputs.
+ */
+void seq_panic(void)
+{
+	seq_stop();
+	
+	pthread_mutex_lock(&s_mutex);
+	mout_panic();
+	pthread_mutex_unlock(&s_mutex);
 }
 
 /*
@@ -117,6 +166,46 @@ int seq_get_pulse(void)
 	return clk_get_pulse(&s_clock);
 }
 
+/*
+ * Returns the step of a line nearest to an absolute timestamp.
+ */
+int seq_get_nearest_step(line_t *line, mio_timestamp_t timestamp)
+{
+	int step = -1;
+	
+	pthread_mutex_lock(&s_mutex);
+	if (s_run_state == SEQ_RUNNING && clk_get_pulse(&s_clock) >= 0)
+		step = line_get_nearest_step(line, clk_get_pulse_pos(&s_clock, timestamp), clk_get_pulse(&s_clock), NULL);
+	pthread_mutex_unlock(&s_mutex);
+	
+	return step;
+}
+
+/*
+ * Records a value into a step of a line.
+ */
+int seq_record_step(line_t *line, int step, mio_timestamp_t timestamp, int value)
+{
+	int ahead = 0;
+	
+	/* the playhead must not move between finding the step and recording it */
+	pthread_mutex_lock(&s_mutex);
+	if (s_run_state != SEQ_RUNNING || clk_get_pulse(&s_clock) < 0)
+		step = -1;
+	else if (step < 0)
+		step = line_get_nearest_step(line, clk_get_pulse_pos(&s_clock, timestamp), clk_get_pulse(&s_clock), &ahead);
+	
+	if (step >= 0) {
+		line_record_step(line, step, value);
+		/* the playhead has not entered the step yet, which would clear it */
+		if (ahead)
+			line_keep_step(line, step);
+	}
+	pthread_mutex_unlock(&s_mutex);
+	
+	return step;
+}
+
 /*
  * Returns the elapsed time in milliseconds since last start.
  */
@@ -126,6 +215,44 @@ int seq_get_elapsed_time(void)
 }
 
 
+/*
+ * Returns a consistent copy of the playback state.
+ */
+void seq_get_snapshot(seq_snapshot_t *snapshot)
+{
+	unsigned int seq;
+	
+	for (;;) {
+		seq = __atomic_load_n(&s_snapshot_seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			/* the sequencer thread is publishing */
+			sched_yield();
+			continue;
+		}
+		memcpy(snapshot, &s_snapshot, sizeof(seq_snapshot_t));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&s_snapshot_seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+}
+
+/*
+ * Posts a latency probe.
+ */
+int seq_post_probe(long long *probe)
+{
+	long long *expected;
+	int i;
+	
+	for (i = 0; i < SEQ_MAX_PROBES; i++) {
+		expected = NULL;
+		if (__atomic_compare_exchange_n(&s_probes[i], &expected, probe, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED) || expected == probe)
+			return 0;
+	}
+	
+	return -1;
+}
+
 /**
  * Sequencer thread.
  * @param data User data
@@ -134,20 +261,101 @@ int seq_get_elapsed_time(void)
 static void *seq_thread(void *data)
 {
 	while (!s_thread_stop) {
+		pthread_mutex_lock(&s_mutex);
+		complete_probes();
 		if (s_run_state == SEQ_RUNNING)
 			clk_update(&s_clock, clock_cb);
+		pthread_mutex_unlock(&s_mutex);
 		usleep(1);
 	}
 	
 	pthread_exit(NULL);
 }
 
+/**
+ * Stores the current time into all pending latency probes.
+ */
+static void complete_probes(void)
+{
+	long long *probe, now = 0;
+	int i;
+	
+	for (i = 0; i < SEQ_MAX_PROBES; i++) {
+		if (!__atomic_load_n(&s_probes[i], __ATOMIC_RELAXED))
+			continue;
+		probe = __atomic_exchange_n(&s_probes[i], NULL, __ATOMIC_ACQUIRE);
+		if (!probe)
+			continue;
+		if (!now)
+			now = lat_now();
+		__atomic_store_n(probe, now, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * Publishes the playback state, also to the state export. Writers are
+ * serialized by the mutex, which must be held.
+ */
+static void publish_snapshot(void)
+{
+	line_t *line;
+	int i, j;
+	
+	/* an odd sequence number marks the snapshot as being written */
+	__atomic_store_n(&s_snapshot_seq, s_snapshot_seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	
+	s_snapshot.run_state = s_run_state;
+	s_snapshot.bpm = s_clock.bpm;
+	s_snapshot.pulse = clk_get_pulse(&s_clock);
+	s_snapshot.elapsed_time = clk_get_elapsed_time(&s_clock);
+	s_snapshot.pulse_time = s_pulse_time;
+	for (i = 0; i < NUM_SEQUENCES; i++) {
+		for (j = 0; j < NUM_LINES; j++) {
+			line = &s_pattern.sequences[i].lines[j];
+			s_snapshot.cur_steps[i][j] = line->cur_step;
+			s_snapshot.step_pulses[i][j] = line->pulses;
+			s_snapshot.gates[i][j] = line_get_gate(line);
+			s_snapshot.line_modes[i][j] = param_get(&line->line_mode);
+			s_snapshot.outputs[i][j] = param_get(&line->output);
+		}
+	}
+	s_snapshot.stats = s_stats;
+	
+	__atomic_store_n(&s_snapshot_seq, s_snapshot_seq + 1, __ATOMIC_RELEASE);
+	
+	vis_publish(&s_snapshot);
+}
+
 /**
  * Callback from clock.
  */
 static void clock_cb(clk_t *clk, int pulse, mio_timestamp_t timestamp)
 {
+	long start = get_cpu_time();
+	
 	//LOG(LOG_INFO, "pulse: %d timestamp: %ld", pulse, timestamp);
 	pattern_pulse(&s_pattern, pulse, timestamp);
+	rec_pulse(pulse);
+	
+	s_stats.lateness = clk_get_lateness(clk);
+	s_pulse_time = lat_now() - s_stats.lateness;
+	lat_add(&s_stats.lateness_hist, s_stats.lateness);
+	s_stats.cpu_time = get_cpu_time() - start;
+	lat_add(&s_stats.cpu_time_hist, s_stats.cpu_time);
+	publish_snapshot();
 	mmi_pulse(pulse, timestamp);
 }
+
+/**
+ * Returns the cpu time used by the sequencer thread.
+ * @return Returns the cpu time in us.
+ */
+static long get_cpu_time(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	
+	return (long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
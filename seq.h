@@ -1,14 +1,42 @@
 #ifndef __SEQ_H__
 #define __SEQ_H__
 
+#include "lat.h"
+#include "mio.h"
 #include "pattern.h"
 
+/** maximum number of pending latency probes */
+#define SEQ_MAX_PROBES 8
+
 /** sequencer run state */
 typedef enum {
 	SEQ_STOPPED,
 	SEQ_RUNNING
 } seq_run_state_t;
 
+/** sequencer thread timing statistics since start */
+typedef struct {
+	long lateness;                 /**< lateness of the last pulse in us */
+	lat_hist_t lateness_hist;      /**< lateness of all pulses */
+	long cpu_time;                 /**< cpu time used by the last pulse in us */
+	lat_hist_t cpu_time_hist;      /**< cpu time used by all pulses */
+} seq_stats_t;
+
+/** playback state published by the sequencer thread on each pulse */
+typedef struct {
+	seq_run_state_t run_state;
+	float bpm;
+	int pulse;
+	mio_timestamp_t elapsed_time;                   /**< time since start in ms */
+	long long pulse_time;                           /**< time the last pulse was due in us, see lat_now() */
+	signed char cur_steps[NUM_SEQUENCES][NUM_LINES]; /**< current step of each line, -1 if none */
+	unsigned short step_pulses[NUM_SEQUENCES][NUM_LINES]; /**< pulses played of the current step of each line */
+	unsigned short gates[NUM_SEQUENCES][NUM_LINES]; /**< step length of each line in pulses */
+	unsigned char line_modes[NUM_SEQUENCES][NUM_LINES]; /**< mode of each line */
+	int outputs[NUM_SEQUENCES][NUM_LINES];          /**< current output value of each line */
+	seq_stats_t stats;
+} seq_snapshot_t;
+
 /**
  * Intializes the sequencer.
  * @return Returns 0 if successful.
@@ -42,6 +70,12 @@ void seq_start(void);
  */
 void seq_stop(void);
 
+/**
+ * Stops the sequencer and silences all outputs, including notes which were
+ * not played by the sequencer (all notes off / all sound off).
+ */
+void seq_panic(void);
+
 /**
  * Continues the sequencer.
  */
@@ -59,6 +93,27 @@ seq_run_state_t seq_get_run_state(void);
  */
 int seq_get_pulse(void);
 
+/**
+ * Returns the step of a line nearest to an absolute timestamp, e.g. the
+ * arrival time of a midi event.
+ * @param line Line
+ * @param timestamp Timestamp
+ * @return Returns the nearest step or -1 if the sequencer is stopped.
+ */
+int seq_get_nearest_step(line_t *line, mio_timestamp_t timestamp);
+
+/**
+ * Records a value into a step of a line, see line_record_step(). A step
+ * ahead of the playhead is kept from being cleared when the playhead enters
+ * it, see line_keep_step().
+ * @param line Line
+ * @param step Step number, -1 for the step nearest to the timestamp
+ * @param timestamp Timestamp
+ * @param value Output value (e.g. note number)
+ * @return Returns the step recorded into or -1 if the sequencer is stopped.
+ */
+int seq_record_step(line_t *line, int step, mio_timestamp_t timestamp, int value);
+
 /**
  * Returns the elapsed time in milliseconds since last start.
  * @return Returns the elapsed time.
@@ -68,4 +123,21 @@ int seq_get_elapsed_time(void);
 
 
 
+/**
+ * Returns a consistent copy of the playback state. Never blocks the
+ * sequencer thread, the copy is retried if it was published meanwhile.
+ * @param snapshot Returns the playback state
+ */
+void seq_get_snapshot(seq_snapshot_t *snapshot);
+
+/**
+ * Posts a latency probe. The next time the sequencer thread runs, it stores
+ * the current time (see lat_now()) into the probe, which tells when changes
+ * made before posting became visible to the sequencer. Posting a probe that
+ * is already pending has no effect.
+ * @param probe Probe, must be set to 0 before posting
+ * @return Returns 0 if successful, -1 if too many probes are pending.
+ */
+int seq_post_probe(long long *probe);
+
 #endif /*__SEQ_H__*/
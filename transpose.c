@@ -0,0 +1,106 @@
+
+#include "log.h"
+#include "transpose.h"
+
+/** maximum number of keys tracked as held */
+#define MAX_HELD_KEYS 16
+
+static int s_channel = -1;
+static int s_root = 60;
+static int s_held[MAX_HELD_KEYS];
+static int s_num_held;
+static volatile int s_transpose;
+
+static void key_pressed(int note);
+static void key_released(int note);
+
+/*
+ * Sets up the keyboard transpose.
+ */
+void transpose_init(int channel, int root)
+{
+	s_channel = channel - 1;
+	s_root = root;
+	s_num_held = 0;
+	s_transpose = 0;
+	
+	if (s_channel >= 0)
+		LOG(LOG_INFO, "transpose on channel %d, root note %d", channel, root);
+}
+
+/*
+ * Processes the events of the sequencer input.
+ */
+void transpose_process(const mio_event_t *events, int count)
+{
+	mio_message_t message;
+	int i;
+	
+	for (i = 0; i < count; i++) {
+		if (!transpose_is_key(&events[i]))
+			continue;
+		message = events[i].message;
+		if (mio_message_cmd(message) == MIO_CMD_NOTE_ON && mio_message_data2(message) > 0)
+			key_pressed(mio_message_data1(message));
+		else
+			key_released(mio_message_data1(message));
+	}
+}
+
+/*
+ * Returns whether an event is a note of the transpose keyboard.
+ */
+int transpose_is_key(const mio_event_t *event)
+{
+	mio_message_t message = event->message;
+	
+	if (s_channel < 0 || mio_message_status(message) >= 0xf0 || mio_message_channel(message) != s_channel)
+		return 0;
+	
+	return mio_message_cmd(message) == MIO_CMD_NOTE_ON || mio_message_cmd(message) == MIO_CMD_NOTE_OFF;
+}
+
+/*
+ * Returns the current transpose in semitones.
+ */
+int transpose_get(void)
+{
+	return s_transpose;
+}
+
+/**
+ * Pushes a key onto the held keys, it becomes the transposing key.
+ * @param note Note number
+ */
+static void key_pressed(int note)
+{
+	key_released(note);
+	
+	if (s_num_held == MAX_HELD_KEYS)
+		key_released(s_held[0]);
+	
+	s_held[s_num_held++] = note;
+	s_transpose = note - s_root;
+}
+
+/**
+ * Removes a key from the held keys. The previous held key takes over.
+ * @param note Note number
+ */
+static void key_released(int note)
+{
+	int i;
+	
+	for (i = 0; i < s_num_held; i++)
+		if (s_held[i] == note)
+			break;
+	if (i == s_num_held)
+		return;
+	
+	for (; i < s_num_held - 1; i++)
+		s_held[i] = s_held[i + 1];
+	s_num_held--;
+	
+	if (s_num_held > 0)
+		s_transpose = s_held[s_num_held - 1] - s_root;
+}
@@ -0,0 +1,35 @@
+#ifndef __TRANSPOSE_H__
+#define __TRANSPOSE_H__
+
+#include "mio.h"
+
+/**
+ * Sets up the keyboard transpose.
+ * @param channel Midi channel (1-16) of the transpose keyboard, 0 to disable
+ * @param root Root note, which transposes by 0
+ */
+void transpose_init(int channel, int root);
+
+/**
+ * Processes the events of the sequencer input.
+ * @param events Events
+ * @param count Number of events
+ */
+void transpose_process(const mio_event_t *events, int count);
+
+/**
+ * Returns whether an event is a note of the transpose keyboard. These
+ * notes only transpose and are not recorded.
+ * @param event Event
+ * @return Returns 1 if the event is a transpose keyboard note.
+ */
+int transpose_is_key(const mio_event_t *event);
+
+/**
+ * Returns the current transpose in semitones. This is the last held key
+ * relative to the root note, the value is kept when all keys are released.
+ * @return Returns the current transpose.
+ */
+int transpose_get(void);
+
+#endif /* __TRANSPOSE_H__ */
@@ -0,0 +1,112 @@
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "seq.h"
+#include "vis.h"
+
+static vis_state_t *s_state;
+static char s_name[128];
+
+/*
+ * Creates the shared memory segment and starts exporting.
+ */
+int vis_open(const char *name)
+{
+	vis_state_t *state;
+	int fd;
+	int result = -1;
+	
+	fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+	if (fd < 0) {
+		LOG(LOG_ERROR, "cannot open shared memory '%s'", name);
+		return -1;
+	}
+	
+	if (ftruncate(fd, sizeof(vis_state_t)) != 0) {
+		LOG(LOG_ERROR, "cannot resize shared memory '%s'", name);
+		goto out;
+	}
+	
+	state = mmap(NULL, sizeof(vis_state_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (state == MAP_FAILED) {
+		LOG(LOG_ERROR, "cannot map shared memory '%s'", name);
+		goto out;
+	}
+	
+	/* readers check the header before looking at the state */
+	memset(state, 0, sizeof(vis_state_t));
+	state->size = sizeof(vis_state_t);
+	state->num_sequences = NUM_SEQUENCES;
+	state->num_lines = NUM_LINES;
+	state->num_steps = NUM_STEPS;
+	state->version = VIS_VERSION;
+	__atomic_store_n(&state->magic, VIS_MAGIC, __ATOMIC_RELEASE);
+	
+	s_state = state;
+	strncpy(s_name, name, sizeof(s_name) - 1);
+	LOG(LOG_INFO, "exporting playback state to '%s' (%d bytes)", name, (int) sizeof(vis_state_t));
+	result = 0;
+	
+out:
+	close(fd);
+	if (result != 0)
+		shm_unlink(name);
+	
+	return result;
+}
+
+/*
+ * Stops exporting and removes the shared memory segment.
+ */
+void vis_close(void)
+{
+	if (!s_state)
+		return;
+	
+	munmap(s_state, sizeof(vis_state_t));
+	shm_unlink(s_name);
+	s_state = NULL;
+}
+
+/*
+ * Exports the playback state.
+ */
+void vis_publish(const seq_snapshot_t *snapshot)
+{
+	vis_state_t *state = s_state;
+	vis_line_t *line;
+	uint32_t seq;
+	int i, j;
+	
+	if (!state)
+		return;
+	
+	/* an odd sequence number marks the state as being written */
+	seq = state->seq;
+	__atomic_store_n(&state->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	
+	state->updates++;
+	state->running = snapshot->run_state == SEQ_RUNNING;
+	state->bpm = snapshot->bpm;
+	state->pulse = snapshot->pulse;
+	state->elapsed_time = snapshot->elapsed_time;
+	state->pulse_time = snapshot->pulse_time;
+	for (i = 0; i < NUM_SEQUENCES; i++) {
+		for (j = 0; j < NUM_LINES; j++) {
+			line = &state->lines[i][j];
+			line->cur_step = snapshot->cur_steps[i][j];
+			line->step_pulses = snapshot->step_pulses[i][j];
+			line->gate = snapshot->gates[i][j];
+			line->mode = snapshot->line_modes[i][j];
+			line->output = snapshot->outputs[i][j];
+		}
+	}
+	
+	__atomic_store_n(&state->seq, seq + 2, __ATOMIC_RELEASE);
+}
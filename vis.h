@@ -0,0 +1,83 @@
+#ifndef __VIS_H__
+#define __VIS_H__
+
+#include <stdint.h>
+
+#include "defines.h"
+#include "seq.h"
+
+/** magic number at the start of the segment ("SSQV") */
+#define VIS_MAGIC 0x56515353
+
+/** layout version, incremented on every incompatible layout change */
+#define VIS_VERSION 1
+
+/**
+ * State of a sequencer line in the export.
+ */
+typedef struct {
+	int32_t cur_step;              /**< current step (0 to num_steps - 1), -1 if the line has not started */
+	int32_t step_pulses;           /**< pulses played of the current step, 1 on its first pulse */
+	int32_t gate;                  /**< length of a step in pulses */
+	int32_t mode;                  /**< line mode, see LINE_MODE_* in defines.h */
+	int32_t output;                /**< current output value, its meaning depends on the mode */
+} vis_line_t;
+
+/**
+ * Layout of the shared memory segment the playback state is exported to.
+ * All fields use the byte order of the host.
+ *
+ * The header (magic to num_steps) is written once when the segment is
+ * created. The rest is protected by a sequence lock: the writer makes seq
+ * odd, updates the state and makes it even again. Readers copy the state
+ * and retry if seq was odd or has changed meanwhile:
+ *
+ *   do {
+ *       seq = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+ *       memcpy(&copy, shared, sizeof(copy));
+ *       __atomic_thread_fence(__ATOMIC_ACQUIRE);
+ *   } while ((seq & 1) || __atomic_load_n(&shared->seq, __ATOMIC_RELAXED) != seq);
+ *
+ * Readers never block the sequencer, they map the segment read only and
+ * can poll it at any rate. The state is updated on every pulse and on
+ * transport and tempo changes.
+ */
+typedef struct {
+	uint32_t magic;                /**< VIS_MAGIC */
+	uint32_t version;              /**< VIS_VERSION */
+	uint32_t size;                 /**< size of this structure in bytes */
+	uint32_t num_sequences;        /**< dimensions of the lines array */
+	uint32_t num_lines;
+	uint32_t num_steps;            /**< number of steps per line */
+	uint32_t seq;                  /**< sequence lock, odd while the state is written */
+	uint32_t updates;              /**< number of updates since the segment was created */
+	uint32_t running;              /**< 1 if the sequencer is running, 0 if stopped */
+	float bpm;                     /**< tempo in beats per minute */
+	int32_t pulse;                 /**< pulses since start, 24 per beat */
+	int32_t elapsed_time;          /**< time since start in ms */
+	int64_t pulse_time;            /**< CLOCK_MONOTONIC time the last pulse was due in us */
+	vis_line_t lines[NUM_SEQUENCES][NUM_LINES];
+} vis_state_t;
+
+/**
+ * Creates the shared memory segment and starts exporting the playback
+ * state to it. Must be called before the sequencer is started.
+ * @param name Name of the segment (e.g. "/ssq-state")
+ * @return Returns 0 if successful.
+ */
+int vis_open(const char *name);
+
+/**
+ * Stops exporting and removes the shared memory segment. Must be called
+ * after the sequencer has been shut down.
+ */
+void vis_close(void);
+
+/**
+ * Exports the playback state. Never blocks, calls must not be made
+ * concurrently (the sequencer serializes them).
+ * @param snapshot Playback state
+ */
+void vis_publish(const seq_snapshot_t *snapshot);
+
+#endif /*__VIS_H__*/